@@ -0,0 +1,382 @@
+/*
+ * @file   fqueue.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  FIFO queue for blocks management
+ *
+ * Lock-free bounded ring buffer. Push and taking for processing
+ * use the sequence number of slot to detect free and filled slots
+ * (Dmitry Vyukov's MPMC queue), removing is done by single writer.
+ * Waiting threads sleep on futex instead of spinning.
+*/
+
+#include <fqueue.h>
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define ATOMIC_LOAD(ptr, order) __atomic_load_n( (ptr), __ATOMIC_##order)
+#define ATOMIC_STORE(ptr, val, order) __atomic_store_n( (ptr), (val), __ATOMIC_##order)
+#define ATOMIC_CAS(ptr, expected, desired) \
+	__atomic_compare_exchange_n( (ptr), (expected), (desired), 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+
+/**
+ * @brief Get current event counter before checking the condition
+ *
+ * @param ev Pointer to event
+ *
+ * @return Value to be passed to fqevent_sleep()
+ */
+static uint32_t fqevent_ticket( fqevent_t *ev) {
+	return ATOMIC_LOAD( &ev->seq, SEQ_CST);
+}
+
+/**
+ * @brief Sleep until event happens
+ *
+ * Returns immediately if any event happened after ticket was taken.
+ *
+ * @param ev Pointer to event
+ * @param ticket Value returned by fqevent_ticket()
+ */
+static void fqevent_sleep( fqevent_t *ev, uint32_t ticket) {
+
+	__atomic_add_fetch( &ev->waiters, 1, __ATOMIC_SEQ_CST);
+
+	if (ATOMIC_LOAD( &ev->seq, SEQ_CST) == ticket)
+		syscall( SYS_futex, &ev->seq, FUTEX_WAIT_PRIVATE, ticket, NULL, NULL, 0);
+
+	__atomic_sub_fetch( &ev->waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief Signal event
+ *
+ * @param ev Pointer to event
+ * @param count Maximal count of threads to wake up
+ */
+static void fqevent_signal( fqevent_t *ev, int count) {
+
+	__atomic_add_fetch( &ev->seq, 1, __ATOMIC_SEQ_CST);
+
+	/* Syscall only if somebody is sleeping */
+	if (ATOMIC_LOAD( &ev->waiters, SEQ_CST) != 0)
+		syscall( SYS_futex, &ev->seq, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/**
+ * @brief Create empty queue
+ *
+ * @param maxlen Maximal count of blocks in queue, FIFO_QUEUE_MAX_LEN if 0.
+ *               Rounded up to power of 2.
+ *
+ * @return Pointer to queue header or NULL
+ */
+fqhdr_t *fqueue_create( uint32_t maxlen) {
+
+	fqhdr_t *fqhdr;
+	uint32_t fqmax = 1;
+
+	if (maxlen == 0)
+		maxlen = FIFO_QUEUE_MAX_LEN;
+
+	while (fqmax < maxlen)
+		fqmax <<= 1;
+
+	if (posix_memalign( (void **) &fqhdr, FQUEUE_CACHELINE, sizeof(fqhdr_t)) != 0)
+		return NULL;
+
+	memset( fqhdr, 0, sizeof(fqhdr_t));
+
+	if (posix_memalign( (void **) &fqhdr->slots, FQUEUE_CACHELINE, fqmax * sizeof(fqslot_t)) != 0) {
+		free( fqhdr);
+		return NULL;
+	}
+
+	/* Slot is free for position equal to its sequence number */
+	for (uint32_t i=0; i<fqmax; i++) {
+		fqhdr->slots[i].seq = i;
+		fqhdr->slots[i].fnode = NULL;
+	}
+
+	fqhdr->fqmax = fqmax;
+
+	return fqhdr;
+}
+
+/**
+ * @brief Destroy queue
+ *
+ * Blocks still in queue are destroyed too.
+ *
+ * @param fqhdr Pointer to queue header
+ */
+void fqueue_destroy( fqhdr_t *fqhdr) {
+
+	if (fqhdr == NULL)
+		return;
+
+	for (uint64_t pos = fqhdr->tail; pos < fqhdr->head; pos++)
+		hblock_destroy( fqhdr->slots[pos & (fqhdr->fqmax - 1)].fnode);
+
+	free( fqhdr->slots);
+	free( fqhdr);
+}
+
+/**
+ * @brief Add block to the head of queue
+ *
+ * Safe for any count of concurrent producers.
+ *
+ * @param fqhdr Pointer to queue header
+ * @param block Block to be added
+ *
+ * @return New length of queue or 0 if queue is full
+ */
+uint32_t fqueue_push_node( fqhdr_t *fqhdr, hblock_t *block) {
+
+	fqslot_t *slot;
+	uint64_t pos;
+
+	assert( fqhdr != NULL);
+	assert( block != NULL);
+
+	pos = ATOMIC_LOAD( &fqhdr->head, RELAXED);
+	while (1) {
+		slot = &fqhdr->slots[pos & (fqhdr->fqmax - 1)];
+
+		int64_t dif = (int64_t) ATOMIC_LOAD( &slot->seq, ACQUIRE) - (int64_t) pos;
+
+		if (dif == 0) {
+			/* Slot is free, try to occupy it */
+			if (ATOMIC_CAS( &fqhdr->head, &pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			/* Slot still used by block from previous round */
+			return 0;
+		} else {
+			pos = ATOMIC_LOAD( &fqhdr->head, RELAXED);
+		}
+	}
+
+	slot->fnode = block;
+	ATOMIC_STORE( &slot->seq, pos + 1, RELEASE);
+
+	/* Block could be already processed and removed, but it was in queue */
+	uint32_t fqlen = (uint32_t) (pos + 1 - ATOMIC_LOAD( &fqhdr->tail, ACQUIRE));
+
+	fqevent_signal( &fqhdr->pushed, 1);
+
+	return fqlen ? fqlen : 1;
+}
+
+/**
+ * @brief Remove the oldest block from queue
+ *
+ * Blocks leave queue in the same order they were pushed and
+ * only after processing is finished (READY or ERROR state).
+ * Only one thread should remove blocks from queue.
+ *
+ * @param fqhdr Pointer to queue header
+ *
+ * @return Block from the tail of queue or NULL if it is not ready yet
+ */
+hblock_t *fqueue_pop_node( fqhdr_t *fqhdr) {
+
+	assert( fqhdr != NULL);
+
+	uint64_t pos = ATOMIC_LOAD( &fqhdr->tail, RELAXED);
+
+	/* Not taken blocks can not be ready */
+	if (pos >= ATOMIC_LOAD( &fqhdr->next, ACQUIRE))
+		return NULL;
+
+	fqslot_t *slot = &fqhdr->slots[pos & (fqhdr->fqmax - 1)];
+	hblock_t *block = slot->fnode;
+
+	hblock_state_t state = hblock_get_state( block);
+	if ((state != READY) && (state != ERROR))
+		return NULL;
+
+	ATOMIC_STORE( &fqhdr->tail, pos + 1, RELEASE);
+	/* Free slot for the next round */
+	ATOMIC_STORE( &slot->seq, pos + fqhdr->fqmax, RELEASE);
+
+	fqevent_signal( &fqhdr->popped, 1);
+
+	return block;
+}
+
+/**
+ * @brief Take the oldest not processed block for processing
+ *
+ * Found block is switched to PROCESSING state, so
+ * no other thread could take it. Safe for any count
+ * of concurrent workers.
+ *
+ * @param fqhdr Pointer to queue header
+ * @param hblock_state State of blocks pushed to queue
+ *
+ * @return Block or NULL if there are no blocks in such state
+ */
+hblock_t *fqueue_get_node( fqhdr_t *fqhdr, hblock_state_t hblock_state) {
+
+	fqslot_t *slot;
+	uint64_t pos;
+
+	assert( fqhdr != NULL);
+
+	pos = ATOMIC_LOAD( &fqhdr->next, RELAXED);
+	while (1) {
+		slot = &fqhdr->slots[pos & (fqhdr->fqmax - 1)];
+
+		int64_t dif = (int64_t) ATOMIC_LOAD( &slot->seq, ACQUIRE) - (int64_t) (pos + 1);
+
+		if (dif == 0) {
+			/* Slot is filled, try to take it */
+			if (ATOMIC_CAS( &fqhdr->next, &pos, pos + 1))
+				break;
+		} else if (dif < 0) {
+			/* Nothing pushed yet */
+			return NULL;
+		} else {
+			pos = ATOMIC_LOAD( &fqhdr->next, RELAXED);
+		}
+	}
+
+	/* Slot can't be freed until we release the block */
+	hblock_t *block = slot->fnode;
+
+	assert( hblock_get_state( block) == hblock_state);
+	hblock_set_state( block, PROCESSING);
+
+	return block;
+}
+
+/**
+ * @brief Add block to queue, wait for free space if needed
+ *
+ * @param fqhdr Pointer to queue header
+ * @param block Block to be added
+ *
+ * @return New length of queue
+ */
+uint32_t fqueue_wait_push( fqhdr_t *fqhdr, hblock_t *block) {
+
+	assert( fqhdr != NULL);
+
+	while (1) {
+		uint32_t ticket = fqevent_ticket( &fqhdr->popped);
+
+		uint32_t fqlen = fqueue_push_node( fqhdr, block);
+		if (fqlen != 0)
+			return fqlen;
+
+		fqevent_sleep( &fqhdr->popped, ticket);
+	}
+}
+
+/**
+ * @brief Remove the oldest block, wait until it is processed if needed
+ *
+ * @param fqhdr Pointer to queue header
+ *
+ * @return Block or NULL if queue is closed and empty
+ */
+hblock_t *fqueue_wait_pop( fqhdr_t *fqhdr) {
+
+	assert( fqhdr != NULL);
+
+	while (1) {
+		uint32_t ticket = fqevent_ticket( &fqhdr->done);
+
+		hblock_t *block = fqueue_pop_node( fqhdr);
+		if (block != NULL)
+			return block;
+
+		if (ATOMIC_LOAD( &fqhdr->closed, ACQUIRE) && (fqueue_length( fqhdr) == 0))
+			return NULL;
+
+		fqevent_sleep( &fqhdr->done, ticket);
+	}
+}
+
+/**
+ * @brief Take block for processing, wait for it if needed
+ *
+ * @param fqhdr Pointer to queue header
+ * @param hblock_state State of blocks pushed to queue
+ *
+ * @return Block or NULL if queue is closed and all blocks are taken
+ */
+hblock_t *fqueue_wait_node( fqhdr_t *fqhdr, hblock_state_t hblock_state) {
+
+	assert( fqhdr != NULL);
+
+	while (1) {
+		uint32_t ticket = fqevent_ticket( &fqhdr->pushed);
+
+		hblock_t *block = fqueue_get_node( fqhdr, hblock_state);
+		if (block != NULL)
+			return block;
+
+		if (ATOMIC_LOAD( &fqhdr->closed, ACQUIRE)) {
+			/* All blocks were pushed before closing */
+			return fqueue_get_node( fqhdr, hblock_state);
+		}
+
+		fqevent_sleep( &fqhdr->pushed, ticket);
+	}
+}
+
+/**
+ * @brief Notify queue that processing of block is finished
+ *
+ * Should be called after block is switched to READY or ERROR
+ * state to wake up the writer.
+ *
+ * @param fqhdr Pointer to queue header
+ * @param block Processed block
+ */
+void fqueue_release_node( fqhdr_t *fqhdr, hblock_t *block) {
+
+	assert( fqhdr != NULL);
+	assert( block != NULL);
+
+	fqevent_signal( &fqhdr->done, 1);
+}
+
+/**
+ * @brief Mark that no more blocks will be pushed
+ *
+ * Wakes up all waiting threads.
+ *
+ * @param fqhdr Pointer to queue header
+ */
+void fqueue_close( fqhdr_t *fqhdr) {
+
+	assert( fqhdr != NULL);
+
+	ATOMIC_STORE( &fqhdr->closed, 1, RELEASE);
+
+	fqevent_signal( &fqhdr->pushed, INT_MAX);
+	fqevent_signal( &fqhdr->done, INT_MAX);
+	fqevent_signal( &fqhdr->popped, INT_MAX);
+}
+
+/**
+ * @brief Get count of blocks in queue
+ *
+ * @param fqhdr Pointer to queue header
+ *
+ * @return Length of queue
+ */
+uint32_t fqueue_length( fqhdr_t *fqhdr) {
+
+	assert( fqhdr != NULL);
+
+	uint64_t tail = ATOMIC_LOAD( &fqhdr->tail, ACQUIRE);
+
+	return (uint32_t) (ATOMIC_LOAD( &fqhdr->head, ACQUIRE) - tail);
+}
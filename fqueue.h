@@ -3,49 +3,178 @@
  * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
  * @date   2014
  * @brief  FIFO queue for blocks management
+ *
+ * Bounded ring buffer of blocks shared between pipeline stages.
+ * Blocks are pushed by reader(s) to the head, taken for processing
+ * by workers in the same order and removed from the tail by the
+ * writer only after processing is finished, so the writer gets
+ * blocks in original order.
+ *
+ * All positions are 64-bit counters which never wrap in practice,
+ * slot index is position modulo size of ring.
 */
 
 #ifndef FQUEUE_H
 #define FQUEUE_H
 
 #include <huffman.h>
-#include <hblocke.h>
+#include <hblock.h>
+
+/** Size of cache line used for padding of shared data */
+#define FQUEUE_CACHELINE 64
+
+#define FQUEUE_ALIGNED __attribute__((aligned(FQUEUE_CACHELINE)))
 
 /**
- * @brief Double linked queue node
+ * @brief Slot of ring buffer
+ *
+ * Every slot occupies its own cache line.
 */
-typedef struct fqnode {
-	struct fqnode *prev; /**< pointer to previous node */
-	struct fqnode *next; /**< pointer to next node */
+typedef struct fqslot {
+	uint64_t seq; /**< position+1 when slot is filled, position+size when free */
 	hblock_t *fnode; /**< pointer to payload */
-} fqnode_t;
-
-
-enum fq_state {
-	READY,
-	BUSY
-};
+} FQUEUE_ALIGNED fqslot_t;
 
-typedef enum fq_state fq_state_t;
+/**
+ * @brief Counter for sleeping on queue events
+*/
+typedef struct fqevent {
+	uint32_t seq; /**< incremented on every event, used as futex word */
+	uint32_t waiters; /**< count of threads sleeping on event */
+} FQUEUE_ALIGNED fqevent_t;
 
-/* 
+/*
  * @brief FIFO queue description
 */
 typedef struct fqhdr {
-	fqnode_t head; /**< pointer to the head of queue */
-	fqnode_t tail; /**< pointer to the tail of queue */
-	uint32_t fqlen; /**< length of queue  */
-	fq_state_t state; /**< detect if some thread manipulating with queue  */
+	uint64_t head FQUEUE_ALIGNED; /**< next position for push */
+	uint64_t next FQUEUE_ALIGNED; /**< next position to be taken for processing */
+	uint64_t tail FQUEUE_ALIGNED; /**< next position for pop */
+	fqevent_t pushed; /**< new block available for processing */
+	fqevent_t done; /**< processing of some block finished */
+	fqevent_t popped; /**< free space available */
+	uint32_t fqmax FQUEUE_ALIGNED; /**< size of ring, power of 2 */
+	uint32_t closed; /**< no more blocks will be pushed */
+	fqslot_t *slots; /**< ring itself */
 } fqhdr_t;
 
 /* Max blocks in queue */
-#define FIFO_QUEUE_MAX_LEN 20
+#define FIFO_QUEUE_MAX_LEN 32
 
+/**
+ * @brief Create empty queue
+ *
+ * @param maxlen Maximal count of blocks in queue, FIFO_QUEUE_MAX_LEN if 0.
+ *               Rounded up to power of 2.
+ *
+ * @return Pointer to queue header or NULL
+ */
+fqhdr_t *fqueue_create( uint32_t maxlen);
+
+/**
+ * @brief Destroy queue
+ *
+ * Blocks still in queue are destroyed too.
+ *
+ * @param fqhdr Pointer to queue header
+ */
+void fqueue_destroy( fqhdr_t *fqhdr);
+
+/**
+ * @brief Add block to the head of queue
+ *
+ * Safe for any count of concurrent producers.
+ *
+ * @param fqhdr Pointer to queue header
+ * @param block Block to be added
+ *
+ * @return New length of queue or 0 if queue is full
+ */
 uint32_t fqueue_push_node( fqhdr_t *fqhdr, hblock_t *block);
 
+/**
+ * @brief Remove the oldest block from queue
+ *
+ * Blocks leave queue in the same order they were pushed and
+ * only after processing is finished (READY or ERROR state).
+ * Only one thread should remove blocks from queue.
+ *
+ * @param fqhdr Pointer to queue header
+ *
+ * @return Block from the tail of queue or NULL if it is not ready yet
+ */
 hblock_t *fqueue_pop_node( fqhdr_t *fqhdr);
 
+/**
+ * @brief Take the oldest not processed block for processing
+ *
+ * Found block is switched to PROCESSING state, so
+ * no other thread could take it. Safe for any count
+ * of concurrent workers.
+ *
+ * @param fqhdr Pointer to queue header
+ * @param hblock_state State of blocks pushed to queue
+ *
+ * @return Block or NULL if there are no blocks in such state
+ */
 hblock_t *fqueue_get_node( fqhdr_t *fqhdr, hblock_state_t hblock_state);
 
-#endif
+/**
+ * @brief Add block to queue, wait for free space if needed
+ *
+ * @param fqhdr Pointer to queue header
+ * @param block Block to be added
+ *
+ * @return New length of queue
+ */
+uint32_t fqueue_wait_push( fqhdr_t *fqhdr, hblock_t *block);
+
+/**
+ * @brief Remove the oldest block, wait until it is processed if needed
+ *
+ * @param fqhdr Pointer to queue header
+ *
+ * @return Block or NULL if queue is closed and empty
+ */
+hblock_t *fqueue_wait_pop( fqhdr_t *fqhdr);
 
+/**
+ * @brief Take block for processing, wait for it if needed
+ *
+ * @param fqhdr Pointer to queue header
+ * @param hblock_state State of blocks pushed to queue
+ *
+ * @return Block or NULL if queue is closed and all blocks are taken
+ */
+hblock_t *fqueue_wait_node( fqhdr_t *fqhdr, hblock_state_t hblock_state);
+
+/**
+ * @brief Notify queue that processing of block is finished
+ *
+ * Should be called after block is switched to READY or ERROR
+ * state to wake up the writer.
+ *
+ * @param fqhdr Pointer to queue header
+ * @param block Processed block
+ */
+void fqueue_release_node( fqhdr_t *fqhdr, hblock_t *block);
+
+/**
+ * @brief Mark that no more blocks will be pushed
+ *
+ * Wakes up all waiting threads.
+ *
+ * @param fqhdr Pointer to queue header
+ */
+void fqueue_close( fqhdr_t *fqhdr);
+
+/**
+ * @brief Get count of blocks in queue
+ *
+ * @param fqhdr Pointer to queue header
+ *
+ * @return Length of queue
+ */
+uint32_t fqueue_length( fqhdr_t *fqhdr);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * @file   harena.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Arena allocator for per-block data
+*/
+
+#include <harena.h>
+#include <assert.h>
+
+/**
+ * @brief Prepare arena
+ *
+ * @param arena Arena to be initialized
+ * @param buffer Initial memory for allocations, could be NULL
+ * @param size Size of initial memory
+ */
+void harena_init( harena_t *arena, void *buffer, size_t size) {
+
+	assert( arena != NULL);
+
+	arena->buffer = buffer;
+	arena->buffer_size = buffer ? size : 0;
+	arena->base = arena->buffer;
+	arena->size = arena->buffer_size;
+	arena->used = 0;
+	arena->chunks = NULL;
+}
+
+/**
+ * @brief Allocate memory from arena
+ *
+ * Memory is aligned to HARENA_ALIGN and valid until harena_reset().
+ *
+ * @param arena Arena
+ * @param size Size of memory
+ *
+ * @return Pointer to memory or NULL if out of memory
+ */
+void *harena_alloc( harena_t *arena, size_t size) {
+
+	assert( arena != NULL);
+
+	/* Padding for alignment of absolute address */
+	size_t pad = (HARENA_ALIGN - ((uintptr_t) (arena->base + arena->used) & (HARENA_ALIGN - 1)))
+		& (HARENA_ALIGN - 1);
+
+	if ((arena->base == NULL) || (arena->used + pad + size > arena->size)) {
+		/* Exhausted, continue in the new chunk */
+		size_t chunk_size = size + HARENA_ALIGN + sizeof(harena_chunk_t);
+
+		if (chunk_size < HARENA_CHUNK)
+			chunk_size = HARENA_CHUNK;
+
+		harena_chunk_t *chunk = malloc( chunk_size);
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+
+		arena->base = (uint8_t *) (chunk + 1);
+		arena->size = chunk_size - sizeof(harena_chunk_t);
+		arena->used = 0;
+
+		pad = (HARENA_ALIGN - ((uintptr_t) arena->base & (HARENA_ALIGN - 1))) & (HARENA_ALIGN - 1);
+	}
+
+	void *ptr = arena->base + arena->used + pad;
+	arena->used += pad + size;
+
+	return ptr;
+}
+
+/**
+ * @brief Release all allocations at once
+ *
+ * Extra chunks are returned to heap, arena is ready for
+ * the next allocations from initial buffer.
+ *
+ * @param arena Arena
+ */
+void harena_reset( harena_t *arena) {
+
+	assert( arena != NULL);
+
+	while (arena->chunks != NULL) {
+		harena_chunk_t *chunk = arena->chunks;
+
+		arena->chunks = chunk->next;
+		free( chunk);
+	}
+
+	arena->base = arena->buffer;
+	arena->size = arena->buffer_size;
+	arena->used = 0;
+}
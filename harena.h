@@ -0,0 +1,74 @@
+/*
+ * @file   harena.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Arena allocator for per-block data
+ *
+ * Memory is taken from the buffer given by owner of arena by
+ * moving a pointer, extra chunks are allocated from heap only if
+ * the buffer is exhausted. Nothing is freed separately, the whole
+ * arena is released by harena_reset().
+*/
+
+#ifndef HARENA_H
+#define HARENA_H
+
+#include <huffman.h>
+
+/** Alignment of every allocation, size of cache line */
+#define HARENA_ALIGN 64
+
+/** Minimal size of extra chunk */
+#define HARENA_CHUNK (64*1024)
+
+/**
+ * @brief Extra chunk taken from heap, data follows the header
+ */
+typedef struct harena_chunk {
+	struct harena_chunk *next; /**< previously allocated chunk */
+} harena_chunk_t;
+
+/**
+ * @brief Arena description
+ */
+typedef struct harena {
+	uint8_t *buffer; /**< initial buffer given by owner */
+	size_t buffer_size; /**< size of initial buffer */
+	uint8_t *base; /**< region used for allocations now */
+	size_t size; /**< size of region */
+	size_t used; /**< bytes taken from region */
+	harena_chunk_t *chunks; /**< extra chunks, the last allocated first */
+} harena_t;
+
+/**
+ * @brief Prepare arena
+ *
+ * @param arena Arena to be initialized
+ * @param buffer Initial memory for allocations, could be NULL
+ * @param size Size of initial memory
+ */
+void harena_init( harena_t *arena, void *buffer, size_t size);
+
+/**
+ * @brief Allocate memory from arena
+ *
+ * Memory is aligned to HARENA_ALIGN and valid until harena_reset().
+ *
+ * @param arena Arena
+ * @param size Size of memory
+ *
+ * @return Pointer to memory or NULL if out of memory
+ */
+void *harena_alloc( harena_t *arena, size_t size);
+
+/**
+ * @brief Release all allocations at once
+ *
+ * Extra chunks are returned to heap, arena is ready for
+ * the next allocations from initial buffer.
+ *
+ * @param arena Arena
+ */
+void harena_reset( harena_t *arena);
+
+#endif /* HARENA_H */
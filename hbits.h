@@ -0,0 +1,43 @@
+/*
+ * @file   hbits.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Helpers for MSB-first bit streams
+ *
+ * Codes are written to stream starting from the most significant
+ * bit, so words are loaded and stored in big endian order.
+*/
+
+#ifndef HBITS_H
+#define HBITS_H
+
+#include <huffman.h>
+
+/**
+ * @brief Load 8 bytes of stream as big endian word
+ *
+ * Stream is written MSB-first, so the first byte goes to the top.
+ */
+static inline uint64_t load_be64( const uint8_t *p) {
+	uint64_t word;
+
+	memcpy( &word, p, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64( word);
+#endif
+	return word;
+}
+
+/**
+ * @brief Store word to stream as 8 big endian bytes
+ *
+ * Store could be unaligned.
+ */
+static inline void store_be64( uint8_t *p, uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64( word);
+#endif
+	memcpy( p, &word, sizeof(word));
+}
+
+#endif /* HBITS_H */
@@ -8,7 +8,60 @@
  */
 
 #include <hblock.h>
+#include <hdecode.h>
+#include <hencode.h>
+#include <histogram.h>
+#include <hcpu.h>
+#include <hframe.h>
 #include <netinet/in.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#if HISTOGRAM_BANKS % ZSTREAMS
+#error "Histogram banks can't be merged into streams statistics"
+#endif
+
+/** Limit of code length for compression, 0 -- limited by encoder only */
+uint32_t hblock_max_codelen = HBLOCK_MAX_CODELEN;
+
+/** Count of bit streams for compression: 1 or ZSTREAMS */
+uint32_t hblock_streams = ZSTREAMS;
+
+/** Size of raw data of blocks, BLOCKSIZE_MIN..BLOCKSIZE_MAX */
+uint32_t hblock_size = BUFFERSIZE;
+
+/** Pool for block structures, NULL -- heap is used */
+static hpool_t *hblock_pool = NULL;
+
+/** Pool for compressed data and frames of blocks, NULL -- heap is used */
+static hpool_t *hblock_zdata_pool = NULL;
+
+/** Pool for raw data of blocks, hblock_size bytes each, NULL -- heap is used */
+hpool_t *hblock_raw_pool = NULL;
+
+/** Bytes occupied by bits */
+#define BITS_TO_BYTES(bits) ((bits)%8 ? (1 + (bits)/8) : ((bits)/8))
+
+/**
+ * @brief Get size of compressed data in bytes
+ *
+ * Every interleaved stream starts from byte boundary.
+ *
+ * @param block Pointer to block
+ *
+ * @return Size of zdata
+ */
+static size_t hblock_zdata_len( hblock_t *block) {
+
+	if (block->zstreams == 0)
+		return BITS_TO_BYTES( (size_t) block->zdata_size);
+
+	size_t len = 0;
+	for (uint32_t i=0; i < block->zstreams; i++)
+		len += BITS_TO_BYTES( (size_t) block->zstreams_bits[i]);
+
+	return len;
+}
 
 /**
  * @brief Read raw data
@@ -81,247 +134,691 @@ uint32_t rawwriter( int fd, hblock_t *block) {
 
 
 /**
- * @brief Prepare block from protobuf message
+ * @brief Unpack code lengths of canonical code from frame
+ *
+ * @param frame Parsed frame
+ * @param[out] lengths Length of code for every symbol
+ *
+ * @return zero on success
+ */
+static int hframe_read_lengths( const hframe_t *frame, uint8_t *lengths) {
+
+	uint32_t n = 0; /**< count of present symbols */
+	const uint8_t *packed;
+	uint32_t packed_len;
+	int nibbles;
+
+	if (frame->symbols_map_len != DICTSIZE/8)
+		return -1;
+
+	if (frame->long_lengths != NULL) {
+		packed = frame->long_lengths;
+		packed_len = frame->long_lengths_len;
+		nibbles = 0;
+	} else if (frame->lengths != NULL) {
+		packed = frame->lengths;
+		packed_len = frame->lengths_len;
+		nibbles = 1;
+	} else {
+		return -1;
+	}
+
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		uint8_t len = 0;
+
+		if (frame->symbols_map[sym >> 3] & (1 << (sym & 7))) {
+			if (nibbles) {
+				if ((n >> 1) >= packed_len)
+					return -1;
+				len = packed[n >> 1];
+				len = (n & 1) ? (len & 0x0F) : (len >> 4);
+			} else {
+				if (n >= packed_len)
+					return -1;
+				len = packed[n];
+			}
+
+			if (len == 0)
+				return -1;
+			n++;
+		}
+
+		lengths[sym] = len;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read exactly size bytes from descriptor
+ *
+ * @param fd File descriptor
+ * @param buffer Buffer for data
+ * @param size Count of bytes to read
+ * @param offset Position in file or -1 for current position
+ *
+ * @return Count of bytes read, less than size on EOF or error
+ */
+static size_t hblock_read_full( int fd, uint8_t *buffer, size_t size, int64_t offset) {
+
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t rd = (offset < 0) ? read( fd, buffer + done, size - done) :
+			pread( fd, buffer + done, size - done, offset + done);
+
+		if (rd <= 0)
+			break;
+
+		done += rd;
+	}
+
+	return done;
+}
+
+/**
+ * @brief Create block for broken frame
+ *
+ * @return Block in ERROR state
+ */
+static hblock_t *hblock_broken( void) {
+
+	hblock_t *block = hblock_create( NULL, 0, ERROR);
+	assert( block != NULL);
+
+	hblock_set_state( block, ERROR);
+
+	return block;
+}
+
+/**
+ * @brief Skip data of stream
  *
  * @param fd Input stream
+ * @param size Count of bytes to skip
  *
- * @return New block with data or NULL on EOF or failure
+ * @return zero on success
  */
-hblock_t *streamreader( int fd) {
+static int hblock_skip( int fd, uint64_t size) {
 
-	FUNC_ENTER();
+	uint8_t buffer[4096];
 
-	hblock_t *block;
-	hnode_t **dictionary;
+	/* Pipes can't seek */
+	if (lseek( fd, size, SEEK_CUR) >= 0)
+		return 0;
 
-	uint8_t *buffer = malloc(HPB_MESSAGE_MAX); /**< temporary storage for data from stream */
-	assert( buffer != NULL);
+	while (size != 0) {
+		size_t len = (size < sizeof(buffer)) ? size : sizeof(buffer);
 
-	hpb_t *hpb = hpb_reader( fd, buffer, HPB_MESSAGE_MAX);
-	if (hpb == NULL) {
-		free( buffer);
-		return NULL;
+		if (hblock_read_full( fd, buffer, len, -1) != len)
+			return -1;
+
+		size -= len;
 	}
 
-	
-	DBGPRINT("Successful read of message with %d b compressed\n", hpb->bits_len);
+	return 0;
+}
 
-	block = hblock_create( hpb->payload.data, hpb->payload.len, ZDATA_READY);
-	block->zdata_size = hpb->bits_len;
+/**
+ * @brief Read frame to buffer owned by the new block
+ *
+ * @param fd Input stream
+ * @param offset Position of frame or -1 for current position
+ *
+ * @return New block with data, block in ERROR state for broken
+ *         frame or NULL on EOF
+ */
+static hblock_t *hblock_read_frame( int fd, int64_t offset) {
 
-	hblock_set_state( block, PROCESSING);
+	FUNC_ENTER();
 
-	/* Create dictionary */
-	/* Create memory region for dictionary */
-	dictionary = malloc( DICTSIZE * sizeof( hnode_t *));
-	assert( dictionary != NULL);
+	hblock_t *block;
+	uint32_t msglen;
+	uint8_t *buffer;
+	hpool_t *pool = NULL;
 
-	block->dictionary = dictionary;
+	/* Frame is size of message in network order followed by message */
+	size_t rd = hblock_read_full( fd, (uint8_t *) &msglen, sizeof(uint32_t), offset);
+	if (rd == 0)
+		return NULL;
 
-	DBGPRINT(" with %d syms, %d codes, %d lengths\n", 
-			hpb->n_symbols_table, 
-			hpb->n_codes_table, 
-			hpb->n_lengths_table 
-			);
+	if (rd != sizeof(uint32_t))
+		return hblock_broken();
 
-	/* Cleanup */
-	memset (dictionary, 0, DICTSIZE * sizeof (hnode_t *));
+	msglen = ntohl( msglen);
+
+	if (msglen & HPB_INDEX_FLAG) {
+		/* Index is not needed for sequential reading */
+		if ((offset >= 0) ||
+				(hblock_skip( fd, (uint64_t) (msglen & ~HPB_INDEX_FLAG) + HPB_INDEX_TRAILER) != 0))
+			return hblock_broken();
 
-	for (int i=0; i < hpb->n_symbols_table; i++) {
-		uint32_t cnt = hpb->symbols_table[i];
+		return hblock_read_frame( fd, -1);
+	}
 
-		dictionary[cnt] = hnode_create( 0, (uint8_t) cnt);
+	if (msglen > HPB_MESSAGE_MAX)
+		return hblock_broken();
 
-		dictionary[cnt]->code = (uint8_t) cnt;
-		dictionary[cnt]->bits = hpb->codes_table[i];
-		dictionary[cnt]->blen = hpb->lengths_table[i];
+	DBGPRINT("Trying to read message with size %u\n", msglen);
 
+	/* Frames written by old versions could be larger than buffers of pool */
+	if ((hblock_zdata_pool != NULL) && (msglen <= hblock_zdata_pool->size)) {
+		pool = hblock_zdata_pool;
+		buffer = hpool_get( pool);
+	} else {
+		buffer = malloc( msglen ? msglen : 1);
 	}
+	assert( buffer != NULL);
 
-	/* TODO: do I need this placeholder here?*/
-	/* Create Huffman tree from collected info */
-	block->head = htree_create(dictionary, DICTSIZE);
-	assert( block->head != NULL);
+	if (offset >= 0)
+		offset += sizeof(uint32_t);
 
-	/* Create Huffman tree */
+	if (hblock_read_full( fd, buffer, msglen, offset) != msglen) {
+		if (pool != NULL)
+			hpool_put( pool, buffer);
+		else
+			free( buffer);
+		return hblock_broken();
+	}
 
-	hpb__free_unpacked( hpb, NULL);
-	free( buffer);
+	block = hblock_adopt( buffer, msglen, ZDATA_READY, pool);
+	assert( block != NULL);
 
-	hblock_set_state( block, ZDATA_READY);
+	/* Parsed later, possibly by another thread */
+	block->frame_size = msglen;
 
 	FUNC_LEAVE();
 	return block;
 }
 
-
-
 /**
- * @brief Read one protobuf message from stream
+ * @brief Parse frame read by framereader()
  *
- * Trying to read 1 message from stream in format:
- * uint32_t length of following message in network order
- * hpb_t    data block in protocol buffer format
+ * Compressed data and tables are used in place. Frames of
+ * stream should be parsed in order if chain is used.
  *
- * @param fd File descriptor to read
- * @param buffer Buffer for stream data
- * @param offset Size of buffer
- * @param out Pointer to unpacked message
+ * @param block Block with not parsed frame
+ * @param chain Table of the previous frame, updated by the frame, or NULL
  *
- * @return Pointer to unpacked message or NULL
+ * @return zero on success, block is switched to ZDATA_READY
+ *         state or to ERROR state for broken frame
  */
-hpb_t * hpb_reader ( int fd, uint8_t *buffer, size_t buffer_size) {
+int hblock_parse( hblock_t *block, hchain_t *chain) {
 
 	FUNC_ENTER();
 
-	hpb_t *msg;
-	static uint32_t msglen;
-	static size_t rd;
-	static uint32_t offset;
-
-	/* check params */
-	assert( buffer != NULL);
-	assert( buffer_size > sizeof(uint32_t));
+	hframe_t frame;
 
-	/* Read size of message */
-	offset = 0;
-	while (1) {
+	assert( block != NULL);
 
-		rd = read( fd, buffer+offset, sizeof(uint32_t)-offset);
-		if (rd <= 0) {
-			/* problems detected */
-			return NULL;
-		}
-		offset += rd;
-		if (( sizeof(uint32_t) - offset) <= 0 )
-			break;
+	if (hblock_get_state( block) == ERROR) {
+		/* Frames after the broken one can't refer to its table */
+		if (chain != NULL)
+			chain->valid = 0;
+		return -1;
 	}
 
-	msglen = ntohl(*(uint32_t *) buffer);
+	assert( block->zbuffer != NULL);
 
-	if (msglen > buffer_size) {
-		return NULL;
-	}
+	uint8_t *buffer = block->zbuffer;
+	uint32_t msglen = block->frame_size;
 
-	DBGPRINT("Trying to read message with size %u\n", msglen);
+	block->frame_size = 0;
 
-	offset = 0;
-	while (1) {
+	hblock_set_state( block, PROCESSING);
 
-		rd = read( fd, buffer+offset, msglen-offset);
+	if (hframe_parse( buffer, msglen, &frame) != 0) {
+		DBGPRINT("Error message detected\n");
+		hblock_set_state( block, ERROR);
+		if (chain != NULL)
+			chain->valid = 0;
+		return -1;
+	}
 
-		if (rd <= 0) {
-			/* problems detected */
-			return NULL;
+	DBGPRINT("Successful read of message with %llu b compressed\n",
+			(unsigned long long) frame.bits_len);
+
+	/* Compressed data is used in place */
+	block->zdata = (uint8_t *) frame.payload;
+	block->zdata_size = frame.bits_len;
+	block->raw_size = frame.has_raw_len ? frame.raw_len : 0;
+	block->type = frame.type;
+
+	/* Payload of other types is raw data or the only byte */
+	if (block->type == HPB_TYPE_STORED)
+		block->zdata_size = (uint64_t) block->raw_size * 8;
+	else if (block->type == HPB_TYPE_RUN)
+		block->zdata_size = 8;
+
+	/* Zero size of raw data means the size is unknown, it is allowed for empty block only */
+	if (frame.has_raw_len && ((frame.raw_len > BLOCKSIZE_MAX) ||
+				((frame.raw_len == 0) && (frame.bits_len != 0)))) {
+		hblock_set_state( block, ERROR);
+	}
+
+	if (frame.n_streams_bits != 0) {
+		/* Interleaved streams, count of symbols is needed to split data between them */
+		uint64_t bits = 0;
+
+		if ((frame.n_streams_bits != ZSTREAMS) || !frame.has_raw_len) {
+			hblock_set_state( block, ERROR);
+		} else {
+			block->zstreams = ZSTREAMS;
+			for (uint32_t i=0; i < ZSTREAMS; i++) {
+				block->zstreams_bits[i] = frame.streams_bits[i];
+				bits += frame.streams_bits[i];
+			}
+
+			/* Every code is at least 1 bit long */
+			if (block->raw_size > bits)
+				hblock_set_state( block, ERROR);
 		}
+	}
 
-		offset += rd;
-		DBGPRINT("Bytes read %d, buffer space left %d\n", (int)rd, (int)(buffer_size-offset));
+	if (!frame.has_payload || (frame.payload_len == 0) ||
+			(hblock_zdata_len( block) > frame.payload_len)) {
+		DBGPRINT("Payload is shorter than coded data\n");
+		hblock_set_state( block, ERROR);
+	}
 
-		if ( (msglen - offset) <= 0 )
-			break;
+	if (block->type != HPB_TYPE_HUFFMAN) {
+		/* No table and streams, the size of raw data is needed */
+		if ((block->type > HPB_TYPE_RUN) || (block->raw_size == 0) || (frame.n_streams_bits != 0) ||
+				frame.reuse_table || (frame.symbols_map != NULL) || (frame.n_symbols_table != 0)) {
+			DBGPRINT("Wrong frame of type %u\n", block->type);
+			hblock_set_state( block, ERROR);
+		}
+	} else if (frame.reuse_table) {
+		/* Table of the previous frame, codes are restored already */
+		if ((chain == NULL) || !chain->valid || (chain->count >= HCHAIN_MAX) ||
+				(frame.symbols_map != NULL) || (frame.n_symbols_table != 0)) {
+			DBGPRINT("No table to reuse\n");
+			hblock_set_state( block, ERROR);
+		} else {
+			memcpy( block->lengths, chain->lengths, sizeof(block->lengths));
+			memcpy( block->codes, chain->codes, sizeof(block->codes));
+			block->reuse_table = 1;
+		}
+	} else if (frame.symbols_map != NULL) {
+		/* Canonical code, restore codes from lengths */
+		if (hframe_read_lengths( &frame, block->lengths) != 0 ||
+				htree_canonical_codes( block->lengths, block->codes, DICTSIZE) != 0) {
+			DBGPRINT("Wrong table of code lengths\n");
+			hblock_set_state( block, ERROR);
+		}
+	} else {
+		/* Explicit table from old versions */
+		DBGPRINT(" with %d syms, %d codes, %d lengths\n", 
+				frame.n_symbols_table, 
+				frame.n_codes_table, 
+				frame.n_lengths_table 
+				);
+
+		if ((frame.n_codes_table != frame.n_symbols_table) ||
+				(frame.n_lengths_table != frame.n_symbols_table) ||
+				(frame.n_symbols_table > DICTSIZE))
+			hblock_set_state( block, ERROR);
+
+		for (int i=0; (i < frame.n_symbols_table) && (hblock_get_state( block) != ERROR); i++) {
+			uint32_t cnt = frame.symbols_table[i];
+
+			if ((cnt >= DICTSIZE) || (frame.lengths_table[i] > UINT8_MAX)) {
+				hblock_set_state( block, ERROR);
+				break;
+			}
+
+			block->codes[cnt] = frame.codes_table[i];
+			block->lengths[cnt] = (uint8_t) frame.lengths_table[i];
+		}
 	}
 
-	DBGPRINT("Message read %d\n", offset);
-	msg = hpb__unpack (NULL, offset, buffer);
+	if (hblock_get_state( block) != ERROR) {
+		hblock_set_state( block, ZDATA_READY);
 
-	if (msg == NULL) {
-		DBGPRINT("Error message detected\n");
-		return NULL;
+		/* The next frames could refer to this table */
+		if ((chain != NULL) && (block->type == HPB_TYPE_HUFFMAN) && !block->reuse_table)
+			hchain_set( chain, block->lengths, block->codes);
+		else if (chain != NULL)
+			hchain_skip( chain);
+	} else if (chain != NULL) {
+		chain->valid = 0;
 	}
-		
-	/* Message parsed, hooray! */
 
+	FUNC_LEAVE();
+
+	return (hblock_get_state( block) != ERROR) ? 0 : -1;
+}
+
+/**
+ * @brief Prepare block from compressed frame
+ *
+ * Frame is read to buffer owned by the new block and parsed
+ * in place, compressed data is decoded right from this buffer.
+ * Index of blocks is skipped.
+ *
+ * @param fd Input stream
+ * @param chain Table of the previous frame or NULL
+ *
+ * @return New block with data, block in ERROR state for broken
+ *         frame or NULL on EOF
+ */
+hblock_t *streamreader( int fd, hchain_t *chain) {
+
+	hblock_t *block = hblock_read_frame( fd, -1);
+
+	if (block != NULL)
+		hblock_parse( block, chain);
+
+	return block;
+}
+
+/**
+ * @brief Read compressed frame without parsing
+ *
+ * Only size of frame is checked, so stream is split to
+ * frames quickly and frames are parsed by hblock_parse()
+ * later. Index of blocks is skipped.
+ *
+ * @param fd Input stream
+ *
+ * @return New block with frame, block in ERROR state for broken
+ *         stream or NULL on EOF
+ */
+hblock_t *framereader( int fd) {
+	return hblock_read_frame( fd, -1);
+}
+
+/**
+ * @brief Prepare block from compressed frame at given position
+ *
+ * Position of descriptor is not changed, so it could be
+ * used by several threads.
+ *
+ * @param fd Input file
+ * @param offset Position of frame in file
+ * @param chain Table of the previous frame or NULL
+ *
+ * @return New block with data, block in ERROR state for broken
+ *         frame or NULL if offset is beyond the end of file
+ */
+hblock_t *streamreader_at( int fd, uint64_t offset, hchain_t *chain) {
 
-	DBGPRINT("Successful read of message\n");
+	hblock_t *block = hblock_read_frame( fd, (int64_t) offset);
+
+	if (block != NULL)
+		hblock_parse( block, chain);
+
+	return block;
+}
+
+/**
+ * @brief Get size of blocks of compressed stream
+ *
+ * The first frame is read at the current position of descriptor,
+ * the position is not changed.
+ *
+ * @param fd Seekable input stream
+ *
+ * @return Size of blocks or 0 if it is unknown: pipe, empty stream
+ *         or stream written by old version
+ */
+uint32_t hblock_stream_size( int fd) {
+
+	FUNC_ENTER();
+
+	hframe_t frame;
+	uint32_t size = 0;
+
+	off_t pos = lseek( fd, 0, SEEK_CUR);
+	if (pos < 0)
+		return 0;
+
+	hblock_t *block = hblock_read_frame( fd, pos);
+	if (block == NULL)
+		return 0;
+
+	if ((hblock_get_state( block) != ERROR) &&
+			(hframe_parse( block->zbuffer, block->frame_size, &frame) == 0) &&
+			frame.has_block_size)
+		size = frame.block_size;
+
+	hblock_destroy( block);
+
+	DBGPRINT("Stream has blocks of %u size\n", size);
 
 	FUNC_LEAVE();
 
-	return msg;
+	return size;
 }
 
 /**
- * @brief Serialize huffman block
+ * @brief Describe frame of compressed block for writing
  *
- * @param fd File descriptor
- * @param block Pointer to huffman block structure 
+ * Size of message, fields and header of payload are packed to
+ * memory of block, payload is referred from zdata. Both stay
+ * valid until block is destroyed.
  *
- * @return Size of data written or 0 on error
+ * @param block Pointer to compressed block
+ * @param[out] iov Parts of frame, HBLOCK_FRAME_IOV entries
+ *
+ * @return Size of frame in bytes
  */
-size_t streamwriter ( int fd, hblock_t *block) {
+size_t hblock_frame( hblock_t *block, struct iovec *iov) {
 
 	FUNC_ENTER();
 
 	hpb_t msg = HPB__INIT;
 
-	uint32_t tablesize=0;
+	uint8_t symbols_map[DICTSIZE/8];
+	uint8_t lengths[DICTSIZE];
 
-	uint32_t symbols_table[DICTSIZE];
-	uint32_t lengths_table[DICTSIZE];
-	uint32_t codes_table[DICTSIZE];
+	uint32_t tablesize=0;
+	uint8_t maxlen=0;
 
 	assert( block != NULL);
 	assert( block->zdata != NULL);
-	assert( block->dictionary != NULL);
 
-	uint32_t zdata_len = block->zdata_size%8?(1+block->zdata_size/8):(block->zdata_size/8);
-	hnode_t **dictionary = block->dictionary;
+	uint32_t zdata_len = hblock_zdata_len( block);
 
-	msg.symbols_table = symbols_table;
-	msg.lengths_table = lengths_table;
-	msg.codes_table = codes_table;
+	/* Fill table of code lengths */
+	memset( symbols_map, 0, sizeof(symbols_map));
+	memset( lengths, 0, sizeof(lengths));
+
+	for(int cnt=0; cnt<DICTSIZE; cnt++) {
+		if (block->lengths[cnt] > maxlen)
+			maxlen = block->lengths[cnt];
+	}
 
-	/* Fill tables */
 	for(int cnt=0; cnt<DICTSIZE; cnt++) {
-		if (dictionary[cnt] == NULL)
-			continue; /* just skip this node */
+		uint8_t len = block->lengths[cnt];
+
+		if (len == 0)
+			continue; /* just skip this symbol */
 
-		symbols_table[tablesize] = dictionary[cnt]->code;
-		lengths_table[tablesize] = dictionary[cnt]->blen;
-		codes_table[tablesize]   = dictionary[cnt]->bits; 
+		symbols_map[cnt >> 3] |= 1 << (cnt & 7);
+
+		if (maxlen > 15)
+			lengths[tablesize] = len;
+		else
+			lengths[tablesize >> 1] |= (tablesize & 1) ? len : (len << 4);
 
 		tablesize++;
 	}
 
+	if (block->type != HPB_TYPE_HUFFMAN) {
+		/* Payload is raw data or the only byte */
+		msg.has_type = 1;
+		msg.type = block->type;
+	} else if (block->reuse_table) {
+		/* Decoder takes table of the previous frame */
+		msg.has_reuse_table = 1;
+		msg.reuse_table = 1;
+	} else {
+		msg.has_symbols_map = 1;
+		msg.symbols_map.data = symbols_map;
+		msg.symbols_map.len = sizeof(symbols_map);
+
+		if (maxlen > 15) {
+			msg.has_long_lengths = 1;
+			msg.long_lengths.data = lengths;
+			msg.long_lengths.len = tablesize;
+		} else {
+			msg.has_lengths = 1;
+			msg.lengths.data = lengths;
+			msg.lengths.len = (tablesize + 1) >> 1;
+		}
+	}
+
 	/* Add sizes */
 	msg.bits_len = block->zdata_size;
-	msg.n_symbols_table = tablesize;
-	msg.n_lengths_table = tablesize;
-	msg.n_codes_table = tablesize;
 
-	msg.payload.data = block->zdata;
-	msg.payload.len  = zdata_len;
+	msg.has_raw_len = 1;
+	msg.raw_len = block->raw_size;
 
-	/** pack start  */
+	msg.has_block_size = 1;
+	msg.block_size = hblock_size;
+
+	if (block->zstreams != 0) {
+		msg.n_streams_bits = block->zstreams;
+		msg.streams_bits = block->zstreams_bits;
+	}
 
-	int msglen = hpb__get_packed_size (&msg);
-	uint8_t *msgbuf = malloc (msglen);
-	hpb__pack (&msg, msgbuf);
+	/*
+	 * Payload is appended after packed fields and written directly
+	 * from zdata: size of message, fields and header of payload
+	 * are collected in small buffer.
+	 */
+	uint8_t *header = harena_alloc( &block->arena, HPB_HEADER_MAX);
+	assert( header != NULL);
+
+	size_t fields_len = hpb__get_packed_size (&msg);
+	assert( fields_len + sizeof(uint32_t) + HPB_PAYLOAD_HEADER_MAX <= HPB_HEADER_MAX);
+
+	size_t hdrlen = sizeof(uint32_t);
+	hdrlen += hpb__pack (&msg, header + hdrlen);
+
+	/* Tag of payload field: number 2, length-delimited */
+	header[hdrlen++] = (2 << 3) | 2;
+	for (uint32_t len = zdata_len; ; len >>= 7) {
+		if (len < 0x80) {
+			header[hdrlen++] = len;
+			break;
+		}
+		header[hdrlen++] = (len & 0x7F) | 0x80;
+	}
 
-	DBGPRINT("Data packed to %d bytes\n", msglen);
+	size_t msglen = hdrlen - sizeof(uint32_t) + zdata_len;
+
+	DBGPRINT("Data packed to %zu bytes\n", msglen);
 
 	/* Use network byte order to save in stream */
 	uint32_t msglen_n = htonl( (uint32_t) msglen);
+	memcpy( header, &msglen_n, sizeof(uint32_t));
 
-	int rc;
-	/* write size of message in network byte order */
-	rc = write ( fd, &msglen_n, sizeof(uint32_t));
-	DBGPRINT("Data written with size %d\n", rc);
-	if ( rc != sizeof(uint32_t)) perror("write failed");
-	assert( rc == sizeof(uint32_t));
-	/* write body */
-	rc = write ( fd, msgbuf, msglen);
-	assert( rc == msglen);
-
-	//hpb__free_unpacked( &msg, NULL);
-	/** pack end */
-	free(msgbuf);
+	iov[0].iov_base = header;
+	iov[0].iov_len = hdrlen;
+	iov[1].iov_base = block->zdata;
+	iov[1].iov_len = zdata_len;
 
 	FUNC_LEAVE();
 
 	return (msglen + sizeof(uint32_t));
 }
 
+/**
+ * @brief Serialize huffman block
+ *
+ * @param fd File descriptor
+ * @param block Pointer to huffman block structure 
+ *
+ * @return Size of data written or 0 on error
+ */
+size_t streamwriter ( int fd, hblock_t *block) {
+
+	FUNC_ENTER();
+
+	struct iovec iov[HBLOCK_FRAME_IOV];
+
+	size_t len = hblock_frame( block, iov);
+
+	ssize_t rc = writev( fd, iov, HBLOCK_FRAME_IOV);
+	DBGPRINT("Data written with size %zd\n", rc);
+	if (rc != (ssize_t) len) perror("write failed");
+	assert( rc == (ssize_t) len);
+
+	FUNC_LEAVE();
+
+	return len;
+}
+
+
+/**
+ * @brief Get clean block structure
+ *
+ * @return Pointer to block or NULL
+ */
+static hblock_t *hblock_alloc( void) {
+
+	hblock_t *block;
+
+	if (hblock_pool != NULL)
+		block = hpool_get( hblock_pool);
+	else
+		block = malloc( sizeof(hblock_t));
+
+	if (block == NULL) {
+		DBGPRINT("Out of memory\n");
+		return NULL;
+	}
+
+	/* Block cleanup */
+	memset( block, 0, offsetof(hblock_t, arena_buffer));
+	harena_init( &block->arena, block->arena_buffer, sizeof(block->arena_buffer));
+
+	return block;
+}
+
+/**
+ * @brief Create pools for blocks and their data
+ *
+ * Without pools every block allocates memory from heap.
+ *
+ * @param count Count of buffers kept in every pool, the maximal
+ *              count of blocks existing at the same time
+ *
+ * @return zero on success
+ */
+int hblock_pools_create( uint32_t count) {
+
+	hblock_pool = hpool_create( sizeof(hblock_t), count);
+	hblock_raw_pool = hpool_create( hblock_size, count);
+
+	/* Optimal code is never longer than 8 bits per symbol, so frame fits too */
+	hblock_zdata_pool = hpool_create( HPB_FRAME_SIZE(hblock_size), count);
+
+	if ((hblock_pool == NULL) || (hblock_raw_pool == NULL) || (hblock_zdata_pool == NULL)) {
+		hblock_pools_destroy();
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Release pools for blocks and their data
+ *
+ * All blocks should be destroyed before.
+ */
+void hblock_pools_destroy( void) {
+
+	hpool_destroy( hblock_pool);
+	hpool_destroy( hblock_raw_pool);
+	hpool_destroy( hblock_zdata_pool);
+
+	hblock_pool = NULL;
+	hblock_raw_pool = NULL;
+	hblock_zdata_pool = NULL;
+}
 
 /**
  * @brief Create hblock structure from raw data block
@@ -338,44 +835,75 @@ hblock_t *hblock_create( uint8_t *buffer, uint32_t size, hblock_state_t state )
 	hblock_t *block;
 	uint8_t *data;
 
-	block = malloc( sizeof(hblock_t));
-	if (block == NULL) {
-		DBGPRINT("Out of memory\n");
-		return NULL;
-	}
-
-	/* Block cleanup */
-	memset( block, 0, sizeof(hblock_t)); 
-
 	if (buffer == NULL) {
 		/*  Create an empty block */
-		hblock_set_state( block, EMPTY);
+		block = hblock_alloc();
+		if (block != NULL)
+			hblock_set_state( block, EMPTY);
 		return block;
 	}
 
-
 	/* Create memory region for data from buffer */
-	data = malloc( size);
+	data = malloc( size ? size : 1);
 	assert( data != NULL);
 
 	memcpy( data, buffer, size);
 
+	block = hblock_adopt( data, size, state, NULL);
+	if (block == NULL)
+		free( data);
+
+	FUNC_LEAVE();
+
+	return block;
+}
+
+/**
+ * @brief Create hblock structure owning the buffer
+ *
+ * Data is not copied, buffer is returned to pool (or freed if
+ * pool is NULL) when block is destroyed.
+ *
+ * @param buffer Pointer to buffer with data
+ * @param size Size of data in buffer
+ * @param state Shows data type in buffer: RAW_READY or ZDATA_READY
+ * @param pool Pool the buffer was taken from or NULL for heap
+ *
+ * @return Pointer to hblock structure or NULL for error, buffer
+ *         stays with caller in case of error
+ */
+hblock_t *hblock_adopt( uint8_t *buffer, uint32_t size, hblock_state_t state, hpool_t *pool) {
+
+	FUNC_ENTER();
+	hblock_t *block;
+
+	assert( buffer != NULL);
+
+	if ((state != RAW_READY) && (state != ZDATA_READY))
+		return NULL;
+
+	block = hblock_alloc();
+	if (block == NULL)
+		return NULL;
+
 	switch( state) {
 		case RAW_READY:
-			block->raw = data;
+			block->raw = buffer;
+			block->rbuffer = buffer;
 			block->raw_size = size;
-			hblock_set_state( block, RAW_READY);
+			block->raw_pool = pool;
 			break;
 		case ZDATA_READY:
-			block->zdata = data;
-			hblock_set_state( block, ZDATA_READY);
+			block->zdata = buffer;
+			block->zbuffer = buffer;
+			block->zdata_pool = pool;
 			break;
 		default:
-			free( data);
-			free( block);
-			return NULL;
+			break;
 	}
 
+	hblock_set_state( block, state);
+
 	FUNC_LEAVE();
 
 	return block;
@@ -383,6 +911,31 @@ hblock_t *hblock_create( uint8_t *buffer, uint32_t size, hblock_state_t state )
 
 
 
+/**
+ * @brief Create hblock structure referring to data
+ *
+ * Data is neither copied nor owned by block, it should stay
+ * valid until block is destroyed.
+ *
+ * @param data Pointer to data
+ * @param size Size of data
+ * @param state Shows data type: RAW_READY or ZDATA_READY
+ *
+ * @return Pointer to hblock structure or NULL for error
+ */
+hblock_t *hblock_view( uint8_t *data, uint32_t size, hblock_state_t state) {
+
+	hblock_t *block = hblock_adopt( data, size, state, NULL);
+
+	/* Nothing to release */
+	if (block != NULL) {
+		block->rbuffer = NULL;
+		block->zbuffer = NULL;
+	}
+
+	return block;
+}
+
 /**
  * @brief Destroy node and associated resources
  *
@@ -396,270 +949,557 @@ void hblock_destroy( hblock_t *block) {
 		return;
 
 	hblock_set_state( block, PROCESSING);
-	if (block->raw != NULL)
-		free( block->raw);
+	if (block->raw_pool != NULL)
+		hpool_put( block->raw_pool, block->rbuffer);
+	else
+		free( block->rbuffer);
 
-	if (block->zdata != NULL)
-		free( block->zdata);
+	if (block->zdata_pool != NULL)
+		hpool_put( block->zdata_pool, block->zbuffer);
+	else
+		free( block->zbuffer);
 
-	if (block->head != NULL)
-		htree_destroy( block->head);
+	/* Everything allocated for block at once */
+	harena_reset( &block->arena);
 
-	if (block->dictionary != NULL)
-		free( block->dictionary);
-
-	free( block);
+	if (hblock_pool != NULL)
+		hpool_put( hblock_pool, block);
+	else
+		free( block);
 
 	FUNC_LEAVE();
 }
 
 /**
- * @brief Compress data block
+ * @brief Find optimal code lengths for statistics
  *
- * @param buffer Pointer to block with raw data
- * @param size Size of data in buffer
+ * Length of codes is limited by hblock_max_codelen.
  *
- * @return zero on success 
+ * @param histogram Frequency of every symbol
+ * @param[out] lengths Length of code for every symbol
+ *
+ * @return Size of data coded with lengths in bits
  */
-int hblock_compress( hblock_t *block) {
+static uint64_t hblock_code_lengths( const uint32_t *histogram, uint8_t *lengths) {
 
-	FUNC_ENTER();
+	uint64_t bits = htree_code_lengths( histogram, lengths, DICTSIZE);
 
-	hnode_t **dictionary;
+	uint32_t maxlen = 0;
+	for (int cnt=0; cnt < DICTSIZE; cnt++) {
+		if (lengths[cnt] > maxlen)
+			maxlen = lengths[cnt];
+	}
 
-	/* Frequency collector */
-	uint32_t histogram[DICTSIZE];
+	/* Too deep tree, find the best code with limited length instead */
+	uint32_t limit = hblock_max_codelen ? hblock_max_codelen : HENCODE_MAX_BITS;
+	if (maxlen > limit) {
+		DBGPRINT("Code length %u is limited to %u\n", maxlen, limit);
+		bits = htree_limited_lengths( histogram, lengths, DICTSIZE, limit);
+		assert( bits != 0);
+	}
 
-	assert( block != NULL);
-	assert( block->raw != NULL);
+	return bits;
+}
 
-	hblock_set_state( block, PROCESSING);
+/**
+ * @brief Store block as is if coding does not shrink it
+ *
+ * @param block Pointer to block
+ * @param bits Size of coded data and code table in bits
+ *
+ * @return non-zero if block is stored
+ */
+static int hblock_store( hblock_t *block, uint64_t bits) {
 
-#ifdef DEBUG
-	/* Should not happen but who cares? */
-	if (block->zdata != NULL)
-		free( block->zdata);
+	/* Empty block has no payload to store */
+	if ((block->raw_size == 0) || (bits < (uint64_t) block->raw_size * 8))
+		return 0;
 
-	if (block->dictionary != NULL)
-		free( block->dictionary);
-#endif
+	DBGPRINT("Block of %u B is stored, coded size is %llu b\n",
+			block->raw_size, (unsigned long long) bits);
 
+	block->type = HPB_TYPE_STORED;
 
-	/* Create memory region for dictionary */
-	dictionary = malloc( DICTSIZE * sizeof( hnode_t *));
-	assert( dictionary != NULL);
+	return 1;
+}
+
+/**
+ * @brief Use table of the previous block if own table does not pay
+ *
+ * Should be called in turn of block, block->lengths and
+ * block->zdata_size are own optimal code. Block is stored if
+ * neither table shrinks it, table of chain is kept then.
+ *
+ * @param block Pointer to block
+ * @param histogram Frequency of every symbol of block
+ * @param chain Table of the previous block
+ *
+ * @return zero on success
+ */
+static int hblock_choose_table( hblock_t *block, const uint32_t *histogram, hchain_t *chain) {
 
-	block->dictionary = dictionary;
+	uint64_t reuse_bits = hchain_cost( chain, histogram);
+	uint64_t own_bits = block->zdata_size + hchain_table_bits( block->lengths);
 
+	/* Gain of own table is smaller than its size */
+	int reuse = (chain->count < HCHAIN_MAX) && (reuse_bits != UINT64_MAX) &&
+			(reuse_bits + HCHAIN_FLAG_BITS <= own_bits);
 
-	/* Cleanup */
-	memset (dictionary, 0, DICTSIZE * sizeof (hnode_t *));
+	if (hblock_store( block, reuse ? reuse_bits + HCHAIN_FLAG_BITS : own_bits)) {
+		hchain_skip( chain);
+		return 0;
+	}
 
-	memset (histogram, 0, DICTSIZE*sizeof(uint32_t));
+	if (reuse) {
+		DBGPRINT("Table is reused, %llu b instead of %llu b\n",
+				(unsigned long long) reuse_bits, (unsigned long long) block->zdata_size);
 
-	/* Get some statistics */
-	for (int cnt=0; cnt < block->raw_size; cnt++) {
-		histogram[block->raw[cnt]] += 1;
+		memcpy( block->lengths, chain->lengths, sizeof(block->lengths));
+		memcpy( block->codes, chain->codes, sizeof(block->codes));
+		block->zdata_size = reuse_bits;
+		block->reuse_table = 1;
+		hchain_skip( chain);
+		return 0;
 	}
 
-	/* Create nodes */
-	for (int cnt=0; cnt < DICTSIZE; cnt++) {
+	if (htree_canonical_codes( block->lengths, block->codes, DICTSIZE) != 0) {
+		chain->valid = 0;
+		return -1;
+	}
 
-		uint32_t value = histogram[cnt];
-		if (value == 0)
-			continue;
+	hchain_set( chain, block->lengths, block->codes);
 
-		if (dictionary[cnt] == NULL) 
-			dictionary[cnt] = hnode_create( 0, cnt);
+	return 0;
+}
 
-		dictionary[cnt]->freq = value;
+/**
+ * @brief Allocate buffer for compressed data of block
+ *
+ * @param block Pointer to block
+ * @param size Size of buffer
+ */
+static void hblock_zdata_alloc( hblock_t *block, size_t size) {
+
+	if ((hblock_zdata_pool != NULL) && (size <= hblock_zdata_pool->size)) {
+		block->zdata = hpool_get( hblock_zdata_pool);
+		block->zdata_pool = hblock_zdata_pool;
+	} else {
+		block->zdata = malloc( size);
+		block->zdata_pool = NULL;
 	}
+	assert( block->zdata != NULL);
+	block->zbuffer = block->zdata;
+}
 
-	/* Create Huffman tree from collected info */
-	block->head = htree_create(dictionary, DICTSIZE);
-	assert( block->head != NULL);
+/**
+ * @brief Release buffer for compressed data of block
+ *
+ * @param block Pointer to block
+ */
+static void hblock_zdata_free( hblock_t *block) {
 
+	if (block->zdata_pool != NULL)
+		hpool_put( block->zdata_pool, block->zbuffer);
+	else
+		free( block->zbuffer);
 
-//	htree_print( block->head, 0);
+	block->zdata = NULL;
+	block->zbuffer = NULL;
+	block->zdata_pool = NULL;
+}
 
-	/* Add codes to symbols and count compressed size in bits */
-	block->zdata_size =  htree_add_codes( block->head, 0, 0);
-	block->zdata = malloc( block->zdata_size%8 ? (1 + block->zdata_size/8) : (block->zdata_size/8));
-	assert( block->zdata != NULL);
+/**
+ * @brief Keep statistics of block for table of the next one
+ *
+ * Symbols of the previous blocks absent in this block keep the
+ * least frequency, so they still have codes in the next table.
+ *
+ * @param chain Chain
+ * @param histogram Frequency of every symbol of block
+ */
+static void hblock_keep_histogram( hchain_t *chain, const uint32_t *histogram) {
 
-	DBGPRINT("buffer with %d b (%d B) symbols compressed to %d b (%d B):\n", 
-			block->raw_size * 8, block->raw_size, 
-			block->zdata_size, block->zdata_size%8?(1 + block->zdata_size/8):(block->zdata_size/8));
-		//htree_print( head, 0);
-	
-	/* Comression */
-	uint32_t bits = 0; /* bits collector */
-	uint32_t maskedbits; /* align data here for byte writing */
-	int shift = 0;
-	uint32_t zpos=0; /* position in compressed buffer */
-
-	/* Optimize a bit */
-	uint8_t *raw = block->raw;
-	uint8_t *zdata = block->zdata;
-
-	for (int cnt=0; cnt < block->raw_size; cnt++) {
-		uint8_t code = raw[cnt];
-		uint32_t codebits = dictionary[code]->bits;
-		uint32_t codelen = dictionary[code]->blen;
-		
-//		DBGPRINT("%d symbol %d -> code %d (%d)\n", cnt, code, codebits, codelen);
-
-		bits <<= codelen;
-		bits |= codebits;
-
-		shift += codelen;
-//		DBGPRINT("Shift %d and bits 0x%X\n", shift, bits);
-
-		while (shift > 7) {
-			maskedbits = bits;
-			shift -= 8;
-
-			maskedbits >>= shift;
-			zdata[zpos] = (uint8_t) maskedbits;
-//			DBGPRINT("%d zpos: Added byte 0x%X\n", zpos, (uint8_t) maskedbits);
-			zpos++;
+	for (int sym=0; sym < DICTSIZE; sym++) {
+		if ((histogram[sym] != 0) || (chain->histogram[sym] == 0))
+			chain->histogram[sym] = histogram[sym];
+		else
+			chain->histogram[sym] = 1;
+	}
+}
+
+/**
+ * @brief Encode block with table built from statistics of the previous block
+ *
+ * Should be called in turn of block. Data is read once: symbols
+ * are counted while they are coded, statistics are kept in chain
+ * for the next block. Table is reused if it is the same as table
+ * of the previous block.
+ *
+ * @param block Pointer to block
+ * @param chain Table and statistics of the previous block
+ *
+ * @return zero if block is coded, non-zero if own table or stored frame
+ *         is needed: table has no code for some symbol or does not shrink block
+ */
+static int hblock_encode_predicted( hblock_t *block, hchain_t *chain) {
+
+	uint32_t histogram[DICTSIZE];
+	uint32_t table[DICTSIZE] HENCODE_ALIGNED;
+
+	if (!chain->has_histogram || (block->raw_size == 0))
+		return 1;
+
+	hblock_code_lengths( chain->histogram, block->lengths);
+
+	if (htree_canonical_codes( block->lengths, block->codes, DICTSIZE) != 0)
+		return 1;
+
+	uint32_t maxlen = hencode_table( block->codes, block->lengths, table);
+	if (maxlen == 0)
+		return 1;
+
+	int reuse = chain->valid && (chain->count < HCHAIN_MAX) &&
+			(memcmp( block->lengths, chain->lengths, sizeof(block->lengths)) == 0);
+
+	/* Coding stops as soon as it does not pay */
+	uint64_t table_bits = reuse ? HCHAIN_FLAG_BITS : hchain_table_bits( block->lengths);
+	uint64_t limit_bits = (uint64_t) block->raw_size * 8;
+
+	if (table_bits >= limit_bits)
+		return 1;
+
+	size_t limit = (limit_bits - table_bits) / 8;
+
+	block->zstreams = 0;
+	if ((hblock_streams == ZSTREAMS) && (block->raw_size >= HBLOCK_STREAMS_MIN_SIZE))
+		block->zstreams = ZSTREAMS;
+
+	hblock_zdata_alloc( block, limit + HENCODE_PAD);
+
+	memset( histogram, 0, sizeof(histogram));
+	block->zdata_size = 0;
+
+	if (block->zstreams == 0) {
+		block->zdata_size = hencode_count( table, maxlen, block->raw, block->raw_size, 1,
+				block->zdata, limit, histogram);
+	} else {
+		/* Streams one by one, padding of stream is overwritten by the next one */
+		uint8_t *out = block->zdata;
+
+		for (int i=0; (i < ZSTREAMS) && (block->zdata_size != UINT64_MAX); i++) {
+			uint64_t bits = hencode_count( table, maxlen, block->raw + i, block->raw_size - i,
+					ZSTREAMS, out, limit - (out - block->zdata), histogram);
+
+			block->zstreams_bits[i] = bits;
+			block->zdata_size = (bits != UINT64_MAX) ? block->zdata_size + bits : UINT64_MAX;
+			out += BITS_TO_BYTES( bits);
 		}
+	}
 
+	/* The only distinct byte is coded as run */
+	uint32_t symbols = 0;
+	for (int sym=0; sym < DICTSIZE; sym++) {
+		if (histogram[sym] != 0)
+			symbols++;
 	}
-	/* last bits should be added too */
-//	DBGPRINT("rest: shift = %d, zpos = %d, bits = 0x%X\n", 
-//			shift, zpos, bits);
-	if( shift != 0) {
-		bits <<= (8-shift);
-		zdata[zpos] = (uint8_t) bits;
-//		DBGPRINT("%d zpos: Added byte 0x%X\n", zpos, (uint8_t) bits);
+
+	if ((block->zdata_size == UINT64_MAX) || (symbols == 1)) {
+		DBGPRINT("Table of the previous block does not fit block of %u B\n", block->raw_size);
+		hblock_zdata_free( block);
+		block->zstreams = 0;
+		return 1;
 	}
 
-	hblock_set_state( block, READY);
+	hblock_keep_histogram( chain, histogram);
+
+	if (reuse) {
+		block->reuse_table = 1;
+		hchain_skip( chain);
+	} else {
+		hchain_set( chain, block->lengths, block->codes);
+	}
 
-	FUNC_LEAVE();
 	return 0;
 }
 
 /**
- * @brief Decompress data block
+ * @brief Compress data block
  *
- * @param buffer Pointer to block with compressed data and huffman tree
+ * Block of the only distinct byte is written as run, block is
+ * stored as is if coding would not shrink it. Table of the
+ * previous block is reused if own table does not pay for its
+ * size. Blocks of stream should have consecutive seq numbers,
+ * they wait for their turn in chain.
+ *
+ * @param buffer Pointer to block with raw data
+ * @param chain Table of the previous block or NULL to write own table
  *
  * @return zero on success 
  */
-int hblock_decompress( hblock_t *block) {
+int hblock_compress( hblock_t *block, hchain_t *chain) {
 
 	FUNC_ENTER();
 
-	uint8_t *hashtable;
-	uint8_t *sizetable; //0 means have no such symbol
-	uint8_t *buffer;
-
-	uint32_t raw_size = 0;
+	/* Frequency collector */
+	uint32_t histogram[DICTSIZE];
 
-	hnode_t **dictionary;
+	/* Frequencies for every interleaved stream */
+	uint32_t streams_histogram[ZSTREAMS][DICTSIZE];
 
 	assert( block != NULL);
-	assert( block->dictionary != NULL);
+	assert( block->raw != NULL);
 
-	hashtable = malloc( BUFFERSIZE * sizeof(uint32_t));
-	assert( hashtable != NULL);
-	memset( hashtable, 0, BUFFERSIZE * sizeof(uint32_t));
+	hblock_set_state( block, PROCESSING);
 
-	sizetable = malloc( BUFFERSIZE * sizeof(uint32_t));
-	assert( sizetable != NULL);
-	memset( sizetable, 0, BUFFERSIZE * sizeof(uint32_t));
+	/* Should not happen but who cares? */
+	assert( block->zdata == NULL);
 
+	block->reuse_table = 0;
+	block->type = HPB_TYPE_HUFFMAN;
 
-	/* Best compression ratio is 1/8 */
-	block->raw = malloc(block->zdata_size * 8);
-	buffer = block->raw;
-	assert( buffer != NULL);
+	/* Single pass with table of the previous block, turn is kept for fallback */
+	int single_pass = (chain != NULL) && hchain_single_pass;
+
+	if (single_pass) {
+		hchain_enter( chain, block->seq);
+
+		if (hblock_encode_predicted( block, chain) == 0) {
+			hchain_leave( chain);
+			hblock_set_state( block, READY);
+
+			FUNC_LEAVE();
+			return 0;
+		}
+	}
+
+	/* Cleanup */
+	memset (histogram, 0, DICTSIZE*sizeof(uint32_t));
+	memset (streams_histogram, 0, sizeof(streams_histogram));
+
+	/* Get some statistics, symbol N belongs to stream N % ZSTREAMS */
+	uint32_t banks[HISTOGRAM_BANKS][DICTSIZE];
+
+	memset (banks, 0, sizeof(banks));
+	hcpu.histogram_banks( block->raw, block->raw_size, banks);
+
+	for (int sym=0; sym < DICTSIZE; sym++) {
+		for (int i=0; i < HISTOGRAM_BANKS; i++)
+			streams_histogram[i % ZSTREAMS][sym] += banks[i][sym];
+
+		for (int i=0; i < ZSTREAMS; i++)
+			histogram[sym] += streams_histogram[i][sym];
+	}
+
+	/* Code lengths and compressed size in bits, codes are canonical */
+	int rc = 0;
+	uint32_t symbols = 0;
+
+	for (int sym=0; sym < DICTSIZE; sym++) {
+		if (histogram[sym] != 0)
+			symbols++;
+	}
 
-	dictionary = block->dictionary;
+	if (single_pass) {
+		/* Statistics of the block predict table of the next one if it is coded */
+		hblock_keep_histogram( chain, histogram);
+		chain->has_histogram = 0;
+	}
+
+	if (symbols == 1) {
+		/* The only distinct byte, no code is needed */
+		block->type = HPB_TYPE_RUN;
+
+		if (chain != NULL) {
+			if (!single_pass)
+				hchain_enter( chain, block->seq);
+			hchain_skip( chain);
+			hchain_leave( chain);
+		}
+	} else if (chain == NULL) {
+		block->zdata_size = hblock_code_lengths( histogram, block->lengths);
+
+		if (!hblock_store( block, block->zdata_size + hchain_table_bits( block->lengths)))
+			rc = htree_canonical_codes( block->lengths, block->codes, DICTSIZE);
+	} else {
+		/* Own table is built in parallel, only the choice is ordered */
+		block->zdata_size = hblock_code_lengths( histogram, block->lengths);
+
+		if (!single_pass)
+			hchain_enter( chain, block->seq);
+		rc = hblock_choose_table( block, histogram, chain);
+		if (single_pass)
+			chain->has_histogram = (block->type == HPB_TYPE_HUFFMAN);
+		hchain_leave( chain);
+	}
+
+	if (rc != 0) {
+		hblock_set_state( block, ERROR);
+		return -1;
+	}
 
-	/* Create masked table here */
+	/* Payload is written right from raw data */
+	if (block->type != HPB_TYPE_HUFFMAN) {
+		block->zdata = block->raw;
+		block->zdata_size = (block->type == HPB_TYPE_STORED) ? (uint64_t) block->raw_size * 8 : 8;
+		block->zstreams = 0;
 
-	for (uint32_t i=0; i<DICTSIZE; i++) {
-		if (dictionary[i] != NULL) {
-			uint32_t hash = ~0;
+		hblock_set_state( block, READY);
 
-			hash <<= (dictionary[i]->blen)+1;
-			hash |= dictionary[i]->bits;
-			hash &= HASHMASK; /* Depends of address length */
-			hashtable[hash] = i; /* dictionary[i]->code */
-			sizetable[hash] = (uint8_t) dictionary[i]->blen;
-//			DBGPRINT("hash 0x%X with size %d (0x%X) = 0x%X\n", hash, sizetable[hash], dictionary[i]->bits, hashtable[hash]);
-//			DBGPRINT("0x%X symbol 0x%X -> code %d (%d)\n", hash, hashtable[hash], dictionary[i]->bits, sizetable[hash]);
+		FUNC_LEAVE();
+		return 0;
+	}
+
+	/* Size of every stream is known from statistics */
+	block->zstreams = 0;
+	if ((hblock_streams == ZSTREAMS) && (block->raw_size >= HBLOCK_STREAMS_MIN_SIZE)) {
+		uint64_t bits = 0;
+
+		block->zstreams = ZSTREAMS;
+		for (int i=0; i < ZSTREAMS; i++) {
+			block->zstreams_bits[i] = 0;
+			for (int sym=0; sym < DICTSIZE; sym++)
+				block->zstreams_bits[i] += streams_histogram[i][sym] * block->lengths[sym];
+			bits += block->zstreams_bits[i];
 		}
+		assert( bits == block->zdata_size);
+	}
+
+	hblock_zdata_alloc( block, hblock_zdata_len( block) + HENCODE_PAD);
 
+	DBGPRINT("buffer with %d b (%d B) symbols compressed to %llu b (%zu B):\n", 
+			block->raw_size * 8, block->raw_size, 
+			(unsigned long long) block->zdata_size, BITS_TO_BYTES( (size_t) block->zdata_size));
+
+	/*
+	 * Comression, the only table used by encoder. It is built for every
+	 * block: chain could hold table of the next block already.
+	 */
+	uint32_t table[DICTSIZE] HENCODE_ALIGNED; /* code and length of every symbol in one word */
+
+	uint32_t maxlen = hencode_table( block->codes, block->lengths, table);
+
+	if (block->zstreams == 0) {
+		uint64_t bits = hcpu.encode( table, maxlen, block->raw, block->raw_size, 1, block->zdata);
+		assert( bits == block->zdata_size);
+	} else {
+		/* Streams one by one, padding of stream is overwritten by the next one */
+		uint8_t *out = block->zdata;
+
+		for (int i=0; i < ZSTREAMS; i++) {
+			uint64_t bits = hcpu.encode( table, maxlen, block->raw + i, block->raw_size - i,
+					ZSTREAMS, out);
+			assert( bits == block->zstreams_bits[i]);
+			out += BITS_TO_BYTES( bits);
+		}
 	}
 
-	uint32_t zdata_size = block->zdata_size;
-	uint32_t zdata_cnt=0;
-	uint32_t zdata_len = zdata_size%8?(1+zdata_size/8):(zdata_size/8);
-	uint8_t *zdata = block->zdata;
+	hblock_set_state( block, READY);
 
-	int bshift = 0; /**< shift in bits word */
-	int shift = 0; /**< shift of current compressed symbol */
-	uint8_t zcurrent;
+	FUNC_LEAVE();
+	return 0;
+}
 
-	uint32_t bits = 0;
-	uint32_t mask = ~0;
+/**
+ * @brief Allocate buffer for raw data of block
+ *
+ * @param block Pointer to block
+ * @param size Size of buffer
+ */
+static void hblock_raw_alloc( hblock_t *block, size_t size) {
+
+	if ((hblock_raw_pool != NULL) && (size <= hblock_raw_pool->size)) {
+		block->raw = hpool_get( hblock_raw_pool);
+		block->raw_pool = hblock_raw_pool;
+	} else {
+		block->raw = malloc( size ? size : 1);
+		block->raw_pool = NULL;
+	}
+	assert( block->raw != NULL);
+	block->rbuffer = block->raw;
+}
 
-	for( int i=0; i<zdata_len; i++) {
-		zcurrent = zdata[i];
-		bits |= (uint32_t) zcurrent;
+/**
+ * @brief Decompress data block
+ *
+ * @param buffer Pointer to block with compressed data and huffman tree
+ * @param ctx Decoder context of calling thread
+ *
+ * @return zero on success 
+ */
+int hblock_decompress( hblock_t *block, hdctx_t *ctx) {
 
-//		DBGPRINT("Num %d from %d = 0x%X -> bits = 0x%X\n", i, zdata_len, zcurrent, bits);
+	FUNC_ENTER();
 
-		bshift=0;
-		do {
+	assert( block != NULL);
+	assert( ctx != NULL);
 
-		   	bits <<= 1;
-			mask <<= 1;
-			bshift++;
-			shift++;
+	/* Broken table of codes */
+	if (hblock_get_state( block) == ERROR)
+		return -1;
 
-			uint32_t hash = bits;
-			uint32_t bmask = ~mask;
-			
-//			bmask >>= (sizeof(uint32_t) - bshift);
+	assert( block->zdata != NULL);
 
-			hash >>= 8;
-			hash &= bmask; // strip before
-			bmask = mask<<1;
-			hash |=	bmask;
-			hash &= HASHMASK;
+	hblock_set_state( block, PROCESSING);
 
-//			DBGPRINT("bits 0x%X -> hash 0x%X (%d of %d) = 0x%X (%d)\n", bits, hash, bshift, shift, hashtable[hash], sizetable[hash]);
+	if (block->type == HPB_TYPE_STORED) {
+		/* Raw data is written right from buffer of frame */
+		block->raw = block->zdata;
 
-			zdata_cnt++;
+		hblock_set_state( block, READY);
+		return 0;
+	}
 
-//			DBGPRINT("hash 0x%X = 0x%X(%d) with size %d -> 0x%X (%d)\n", hash, hashtable[hash], zdata_cnt, shift,  buffer[raw_size], raw_size);
-			if ( sizetable[hash] == shift) {
-				buffer[raw_size] = (uint8_t) hashtable[hash];
-//				DBGPRINT("Hit hash 0x%X = 0x%X(%d) with size %d -> 0x%X (%d)\n", hash, hashtable[hash], zdata_cnt, shift,  buffer[raw_size], raw_size);
-				raw_size++;
-				mask = ~0;
-				shift = 0;
-			}
+	if (block->type == HPB_TYPE_RUN) {
+		hblock_raw_alloc( block, block->raw_size);
+		memset( block->raw, block->zdata[0], block->raw_size);
 
+		hblock_set_state( block, READY);
+		return 0;
+	}
 
-			
+	/* Consecutive blocks often have the same table, it is built once */
+	const hdtable_t *table = hdctx_table( ctx, block->codes, block->lengths, block->raw_size);
 
-			if( zdata_cnt%8 == 0)
-				break;
-		} while (zdata_cnt < zdata_size);
+	if (table == NULL) {
+		hblock_set_state( block, ERROR);
+		return -1;
 	}
 
+	if (block->zstreams != 0) {
+		hblock_raw_alloc( block, block->raw_size);
 
+		int rc = hcpu.decode_streams( table, block->zdata, block->zstreams_bits,
+				block->raw, block->raw_size);
+
+		if (rc != 0) {
+			hblock_set_state( block, ERROR);
+			return -1;
+		}
+	} else {
+		/*
+		 * Size of raw data is absent in old streams, every code is at
+		 * least 1 bit long and old versions used blocks of BUFFERSIZE.
+		 */
+		size_t out_size = block->raw_size;
 
-	block->raw_size = raw_size;
+		if (out_size == 0)
+			out_size = (block->zdata_size < BUFFERSIZE) ? block->zdata_size : BUFFERSIZE;
 
-	free( hashtable);
-	free( sizetable);
+		hblock_raw_alloc( block, out_size);
+
+		int64_t raw_size = hcpu.decode( table, block->zdata, block->zdata_size,
+				block->raw, out_size);
+
+		/* Size of raw data is absent in old streams */
+		if ((raw_size < 0) || (block->raw_size && (raw_size != block->raw_size))) {
+			hblock_set_state( block, ERROR);
+			return -1;
+		}
+
+		block->raw_size = (uint32_t) raw_size;
+	}
+
+	hblock_set_state( block, READY);
 
 	FUNC_LEAVE();
 
@@ -680,12 +1520,19 @@ hblock_state_t hblock_get_state( hblock_t *block) {
 
 	FUNC_ENTER();
 
+	hblock_state_t state;
+
 	assert( block != NULL);
 
+	/* State is the only field shared between pipeline threads */
+#ifdef _OPENMP
+	#pragma omp atomic read seq_cst
+#endif
+	state = block->state;
+
 	FUNC_LEAVE();
 
-	/* TODO: add openmp  */
-	return block->state;
+	return state;
 }
 
 
@@ -703,12 +1550,15 @@ hblock_state_t hblock_set_state( hblock_t *block, hblock_state_t state) {
 
 	assert( block != NULL);
 
-	/* TODO: add openmp  */
+	/* Data of block should be visible for other threads before the state */
+#ifdef _OPENMP
+	#pragma omp atomic write seq_cst
+#endif
 	block->state = state;
 
-	return block->state;
-
 	FUNC_LEAVE();
+
+	return state;
 }
 
 
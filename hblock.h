@@ -7,15 +7,37 @@
  *
  */
 
+#ifndef HBLOCK_H
+#define HBLOCK_H
+
 #include <huffman.h>
 #include <htree.h>
+#include <harena.h>
+#include <hpool.h>
+#include <hchain.h>
+#include <hdecode.h>
+#include <sys/uio.h>
 
 /**
- * In worst cases depth of tree could be up to Logarithm base 2 from BUFFERSIZE
- * 
- * TODO: For now it is hardcoded but could be calculated for size optimization
+ * Default limit of code length. Length of such codes fits into 4 bits
+ * of table in stream and several codes fit into bit buffer of decoder.
  */
-#define HASHMASK BUFFERSIZE-1 
+#define HBLOCK_MAX_CODELEN 15
+
+/** Limit of code length for compression, 0 -- limited by encoder only */
+extern uint32_t hblock_max_codelen;
+
+/** Memory for per-block allocations inside of block, enough for header of frame */
+#define HBLOCK_ARENA_SIZE (HPB_HEADER_MAX + HARENA_ALIGN)
+
+/** Blocks smaller than this are always coded as single stream */
+#define HBLOCK_STREAMS_MIN_SIZE 1024
+
+/** Count of bit streams for compression: 1 or ZSTREAMS */
+extern uint32_t hblock_streams;
+
+/** Size of raw data of blocks, BLOCKSIZE_MIN..BLOCKSIZE_MAX */
+extern uint32_t hblock_size;
 
 /**
  * @brief States of block processing
@@ -44,11 +66,23 @@ typedef enum hblock_state hblock_state_t;
 struct hblock {
 	hblock_state_t state;
 	uint8_t   * raw; /**< Raw (uncompressed data) */
+	uint8_t   * rbuffer; /**< Memory owning raw, NULL if raw is a view */
 	uint32_t  raw_size; /**< Raw data size in bytes */
 	uint8_t   * zdata; /**< Compressed data with Huffman's algorithm */
-	uint32_t  zdata_size; /**< Compressed data size in bits */
-	hnode_t *head; /**< Pointer to head of Huffman tree */
-	hnode_t **dictionary; /**< Need for speedup serialization (direct pointers to nodes in tree) */
+	uint8_t   * zbuffer; /**< Memory owning zdata, zdata could point inside of it, NULL for view */
+	uint64_t  zdata_size; /**< Compressed data size in bits */
+	uint32_t  frame_size; /**< Size of frame in zbuffer not parsed yet, 0 if parsed */
+	hpool_t   * raw_pool; /**< Pool owning rbuffer, NULL -- heap */
+	hpool_t   * zdata_pool; /**< Pool owning zbuffer, NULL -- heap */
+	uint32_t  zstreams; /**< Count of interleaved bit streams in zdata, 0 for single stream */
+	uint32_t  zstreams_bits[ZSTREAMS]; /**< Size of every stream in bits */
+	uint8_t   lengths[DICTSIZE]; /**< Length of canonical code for every symbol, 0 if absent */
+	uint32_t  codes[DICTSIZE]; /**< Canonical code for every symbol */
+	uint32_t  reuse_table; /**< Code table of the previous frame is used */
+	uint32_t  type; /**< Type of payload, HPB_TYPE_HUFFMAN for coded data */
+	uint32_t  seq; /**< Number of block in stream, turn of block in chain */
+	harena_t  arena; /**< Allocator for temporary data of block, released on destroy */
+	uint8_t   arena_buffer[HBLOCK_ARENA_SIZE]; /**< Initial memory of arena */
 };
 
 typedef struct hblock hblock_t;
@@ -66,6 +100,58 @@ typedef struct _Hpb hpb_t;
  */
 hblock_t *hblock_create( uint8_t *buffer, uint32_t size, hblock_state_t state );
 
+/**
+ * @brief Create hblock structure owning the buffer
+ *
+ * Data is not copied, buffer is returned to pool (or freed if
+ * pool is NULL) when block is destroyed.
+ *
+ * @param buffer Pointer to buffer with data
+ * @param size Size of data in buffer
+ * @param state Shows data type in buffer: RAW_READY or ZDATA_READY
+ * @param pool Pool the buffer was taken from or NULL for heap
+ *
+ * @return Pointer to hblock structure or NULL for error, buffer
+ *         stays with caller in case of error
+ */
+hblock_t *hblock_adopt( uint8_t *buffer, uint32_t size, hblock_state_t state, hpool_t *pool);
+
+/** Pool for raw data of blocks, hblock_size bytes each, NULL -- heap is used */
+extern hpool_t *hblock_raw_pool;
+
+/**
+ * @brief Create hblock structure referring to data
+ *
+ * Data is neither copied nor owned by block, it should stay
+ * valid until block is destroyed.
+ *
+ * @param data Pointer to data
+ * @param size Size of data
+ * @param state Shows data type: RAW_READY or ZDATA_READY
+ *
+ * @return Pointer to hblock structure or NULL for error
+ */
+hblock_t *hblock_view( uint8_t *data, uint32_t size, hblock_state_t state);
+
+/**
+ * @brief Create pools for blocks and their data
+ *
+ * Without pools every block allocates memory from heap.
+ *
+ * @param count Count of buffers kept in every pool, the maximal
+ *              count of blocks existing at the same time
+ *
+ * @return zero on success
+ */
+int hblock_pools_create( uint32_t count);
+
+/**
+ * @brief Release pools for blocks and their data
+ *
+ * All blocks should be destroyed before.
+ */
+void hblock_pools_destroy( void);
+
 /**
  * @brief Destroy node and associated resources
  *
@@ -96,21 +182,28 @@ hblock_state_t hblock_set_state( hblock_t *block, hblock_state_t state);
 /**
  * @brief Compress data block
  *
+ * Block of the only distinct byte is written as run, block is
+ * stored as is if coding would not shrink it. Table of the
+ * previous block is reused if own table does not pay for its
+ * size. Blocks of stream should have consecutive seq numbers,
+ * they wait for their turn in chain.
+ *
  * @param buffer Pointer to block with raw data
- * @param size Size of data in buffer
+ * @param chain Table of the previous block or NULL to write own table
  *
  * @return zero on success 
  */
-int hblock_compress( hblock_t *block);
+int hblock_compress( hblock_t *block, hchain_t *chain);
 
 /**
  * @brief Decompress data block
  *
  * @param buffer Pointer to block with compressed data and huffman tree
+ * @param ctx Decoder context of calling thread
  *
  * @return zero on success 
  */
-int hblock_decompress( hblock_t *block);
+int hblock_decompress( hblock_t *block, hdctx_t *ctx);
 
 /**
  * @brief Read raw data
@@ -138,29 +231,92 @@ uint32_t rawreader ( int fd, uint8_t *buffer, size_t buffer_size);
 uint32_t rawwriter( int fd, hblock_t *block);
 
 /**
- * @brief Prepare block from protobuf message
+ * @brief Prepare block from compressed frame
+ *
+ * Frame is read to buffer owned by the new block and parsed
+ * in place, compressed data is decoded right from this buffer.
+ * Index of blocks is skipped.
  *
  * @param fd Input stream
+ * @param chain Table of the previous frame or NULL
  *
- * @return New block with data or NULL on EOF or failure
+ * @return New block with data, block in ERROR state for broken
+ *         frame or NULL on EOF
  */
-hblock_t *streamreader( int fd);
+hblock_t *streamreader( int fd, hchain_t *chain);
 
 /**
- * @brief Read one message from stream
+ * @brief Read compressed frame without parsing
  *
- * Trying to read 1 message from stream in format:
- * uint32_t length of following message in network order
- * hpb_t    data block in protocol buffer format
+ * Only size of frame is checked, so stream is split to
+ * frames quickly and frames are parsed by hblock_parse()
+ * later. Index of blocks is skipped.
  *
- * @param fd File descriptor to read
- * @param buffer Buffer for stream data
- * @param buffer_size Size of buffer
+ * @param fd Input stream
+ *
+ * @return New block with frame, block in ERROR state for broken
+ *         stream or NULL on EOF
+ */
+hblock_t *framereader( int fd);
+
+/**
+ * @brief Parse frame read by framereader()
+ *
+ * Compressed data and tables are used in place. Frames of
+ * stream should be parsed in order if chain is used.
  *
- * @return Pointer to unpacked message or NULL
+ * @param block Block with not parsed frame
+ * @param chain Table of the previous frame, updated by the frame, or NULL
+ *
+ * @return zero on success, block is switched to ZDATA_READY
+ *         state or to ERROR state for broken frame
  */
-hpb_t * hpb_reader ( int fd, uint8_t *buffer, size_t buffer_size);
+int hblock_parse( hblock_t *block, hchain_t *chain);
 
+/**
+ * @brief Prepare block from compressed frame at given position
+ *
+ * Position of descriptor is not changed, so it could be
+ * used by several threads.
+ *
+ * @param fd Input file
+ * @param offset Position of frame in file
+ * @param chain Table of the previous frame or NULL
+ *
+ * @return New block with data, block in ERROR state for broken
+ *         frame or NULL if offset is beyond the end of file
+ */
+hblock_t *streamreader_at( int fd, uint64_t offset, hchain_t *chain);
+
+/**
+ * @brief Get size of blocks of compressed stream
+ *
+ * The first frame is read at the current position of descriptor,
+ * the position is not changed.
+ *
+ * @param fd Seekable input stream
+ *
+ * @return Size of blocks or 0 if it is unknown: pipe, empty stream
+ *         or stream written by old version
+ */
+uint32_t hblock_stream_size( int fd);
+
+/** Count of parts of frame: header and payload */
+#define HBLOCK_FRAME_IOV 2
+
+/**
+ * @brief Describe frame of compressed block for writing
+ *
+ * Size of message, fields and header of payload are packed to
+ * memory of block, payload is referred from zdata. Both stay
+ * valid until block is destroyed.
+ *
+ * @param block Pointer to compressed block
+ * @param[out] iov Parts of frame, HBLOCK_FRAME_IOV entries
+ *
+ * @return Size of frame in bytes
+ */
+size_t hblock_frame( hblock_t *block, struct iovec *iov);
 
 /**
  * @brief Serialize huffman block
@@ -172,5 +328,4 @@ hpb_t * hpb_reader ( int fd, uint8_t *buffer, size_t buffer_size);
  */
 size_t streamwriter ( int fd, hblock_t *block);
 
-
-
+#endif /* HBLOCK_H */
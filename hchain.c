@@ -0,0 +1,159 @@
+/*
+ * @file   hchain.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Code table shared by consecutive blocks
+*/
+
+#include <hchain.h>
+
+#include <assert.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/** Encode every block with table built from statistics of the previous block */
+uint32_t hchain_single_pass = 0;
+
+/**
+ * @brief Prepare empty chain
+ *
+ * @param chain Chain
+ */
+void hchain_init( hchain_t *chain) {
+
+	assert( chain != NULL);
+
+	memset( chain, 0, sizeof(hchain_t));
+}
+
+/**
+ * @brief Wait for turn of block
+ *
+ * @param chain Chain
+ * @param turn Number of block in stream
+ */
+void hchain_enter( hchain_t *chain, uint32_t turn) {
+
+	assert( chain != NULL);
+
+	while (1) {
+		uint32_t current = __atomic_load_n( &chain->turn, __ATOMIC_ACQUIRE);
+
+		if (current == turn)
+			break;
+
+		__atomic_add_fetch( &chain->waiters, 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n( &chain->turn, __ATOMIC_SEQ_CST) == current)
+			syscall( SYS_futex, &chain->turn, FUTEX_WAIT_PRIVATE, current, NULL, NULL, 0);
+
+		__atomic_sub_fetch( &chain->waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/**
+ * @brief Pass turn to the next block
+ *
+ * @param chain Chain
+ */
+void hchain_leave( hchain_t *chain) {
+
+	assert( chain != NULL);
+
+	__atomic_add_fetch( &chain->turn, 1, __ATOMIC_SEQ_CST);
+
+	/* Only one of waiters has the next turn, but which one is unknown */
+	if (__atomic_load_n( &chain->waiters, __ATOMIC_SEQ_CST) != 0)
+		syscall( SYS_futex, &chain->turn, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+/**
+ * @brief Set table carried by frame
+ *
+ * @param chain Chain
+ * @param lengths Length of code for every symbol
+ * @param codes Canonical code for every symbol
+ */
+void hchain_set( hchain_t *chain, const uint8_t *lengths, const uint32_t *codes) {
+
+	assert( chain != NULL);
+
+	memcpy( chain->lengths, lengths, sizeof(chain->lengths));
+	memcpy( chain->codes, codes, sizeof(chain->codes));
+	chain->valid = 1;
+	chain->count = 0;
+}
+
+/**
+ * @brief Pass frame without own table
+ *
+ * Stored, run and reusing frames are counted, so frame reusing
+ * table is never farther than HCHAIN_MAX frames from the one
+ * carrying it.
+ *
+ * @param chain Chain
+ */
+void hchain_skip( hchain_t *chain) {
+
+	assert( chain != NULL);
+
+	if (chain->count < HCHAIN_MAX)
+		chain->count++;
+}
+
+/**
+ * @brief Check if table of chain could encode data
+ *
+ * @param chain Chain
+ * @param histogram Frequency of every symbol of data
+ *
+ * @return Size of data coded with table in bits or UINT64_MAX if
+ *         some symbol has no code
+ */
+uint64_t hchain_cost( const hchain_t *chain, const uint32_t *histogram) {
+
+	uint64_t bits = 0;
+
+	assert( chain != NULL);
+
+	if (!chain->valid)
+		return UINT64_MAX;
+
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		if ((histogram[sym] != 0) && (chain->lengths[sym] == 0))
+			return UINT64_MAX;
+
+		bits += (uint64_t) histogram[sym] * chain->lengths[sym];
+	}
+
+	return bits;
+}
+
+/**
+ * @brief Estimate size of code table in frame
+ *
+ * Symbols map and packed lengths with their tags, see hblock_frame().
+ *
+ * @param lengths Length of code for every symbol
+ *
+ * @return Size of table in bits
+ */
+uint32_t hchain_table_bits( const uint8_t *lengths) {
+
+	uint32_t count = 0;
+	uint32_t maxlen = 0;
+
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		if (lengths[sym] != 0)
+			count++;
+		if (lengths[sym] > maxlen)
+			maxlen = lengths[sym];
+	}
+
+	uint32_t len = (maxlen > 15) ? count : (count + 1) / 2;
+
+	/* Tag and length of both fields */
+	uint32_t bytes = 2 + DICTSIZE/8 + 1 + ((len < 0x80) ? 1 : 2) + len;
+
+	return bytes * 8;
+}
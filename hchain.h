@@ -0,0 +1,111 @@
+/*
+ * @file   hchain.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Code table shared by consecutive blocks
+ *
+ * Frame could refer to the code table of the previous frame instead
+ * of carrying its own one. Chain keeps the table used by the last
+ * block, so both compressor and decompressor should pass blocks
+ * through the chain in order of stream.
+ *
+ * Blocks are compressed in parallel, so every block waits for its
+ * turn before using the chain. Turn is the number of block in
+ * stream, all work except of table choice is done outside of turn.
+ * In single pass mode block is coded in its turn: symbols are counted
+ * while they are coded and the next block builds table from them.
+*/
+
+#ifndef HCHAIN_H
+#define HCHAIN_H
+
+#include <huffman.h>
+
+/** Maximal distance of frame reusing table from the one carrying it, limits reading back */
+#define HCHAIN_MAX 16
+
+/** Size of flag of frame reusing table in bits */
+#define HCHAIN_FLAG_BITS (2*8)
+
+/** Encode every block with table built from statistics of the previous block */
+extern uint32_t hchain_single_pass;
+
+/**
+ * @brief State of chain
+ */
+typedef struct hchain {
+	uint32_t turn; /**< number of block allowed to use chain, futex word */
+	uint32_t waiters; /**< count of threads sleeping for their turn */
+	int valid; /**< table is set */
+	uint32_t count; /**< count of frames after the one carrying table, up to HCHAIN_MAX */
+	uint8_t lengths[DICTSIZE]; /**< length of code for every symbol, 0 if absent */
+	uint32_t codes[DICTSIZE]; /**< canonical code for every symbol */
+	int has_histogram; /**< histogram of the previous block is set, it was coded with Huffman code */
+	uint32_t histogram[DICTSIZE]; /**< statistics of the previous block for single pass mode */
+} hchain_t;
+
+/**
+ * @brief Prepare empty chain
+ *
+ * @param chain Chain
+ */
+void hchain_init( hchain_t *chain);
+
+/**
+ * @brief Wait for turn of block
+ *
+ * @param chain Chain
+ * @param turn Number of block in stream
+ */
+void hchain_enter( hchain_t *chain, uint32_t turn);
+
+/**
+ * @brief Pass turn to the next block
+ *
+ * @param chain Chain
+ */
+void hchain_leave( hchain_t *chain);
+
+/**
+ * @brief Set table carried by frame
+ *
+ * @param chain Chain
+ * @param lengths Length of code for every symbol
+ * @param codes Canonical code for every symbol
+ */
+void hchain_set( hchain_t *chain, const uint8_t *lengths, const uint32_t *codes);
+
+/**
+ * @brief Pass frame without own table
+ *
+ * Stored, run and reusing frames are counted, so frame reusing
+ * table is never farther than HCHAIN_MAX frames from the one
+ * carrying it.
+ *
+ * @param chain Chain
+ */
+void hchain_skip( hchain_t *chain);
+
+/**
+ * @brief Check if table of chain could encode data
+ *
+ * @param chain Chain
+ * @param histogram Frequency of every symbol of data
+ *
+ * @return Size of data coded with table in bits or UINT64_MAX if
+ *         some symbol has no code
+ */
+uint64_t hchain_cost( const hchain_t *chain, const uint32_t *histogram);
+
+/**
+ * @brief Estimate size of code table in frame
+ *
+ * Symbols map and packed lengths with their tags, see hblock_frame().
+ *
+ * @param lengths Length of code for every symbol
+ *
+ * @return Size of table in bits
+ */
+uint32_t hchain_table_bits( const uint8_t *lengths);
+
+#endif /* HCHAIN_H */
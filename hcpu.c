@@ -0,0 +1,57 @@
+/*
+ * @file   hcpu.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Selection of kernels for CPU of the host
+*/
+
+#include <hcpu.h>
+#include <hencode.h>
+
+/** Use portable kernels only, for checking variants for CPU */
+uint32_t hcpu_portable = 0;
+
+/** Features of CPU detected by hcpu_init() */
+uint32_t hcpu_features = 0;
+
+/** Kernels in use, portable ones until hcpu_init() is called */
+hcpu_kernels_t hcpu = {
+	.histogram_banks = histogram_banks,
+	.encode = hencode,
+	.decode = hdecode,
+	.decode_streams = hdecode_streams,
+};
+
+/**
+ * @brief Detect features of CPU and select kernels
+ *
+ * Should be called before blocks are processed.
+ */
+void hcpu_init( void) {
+
+	FUNC_ENTER();
+
+	hcpu_features = 0;
+
+#ifdef __x86_64__
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports( "bmi2"))
+		hcpu_features |= HCPU_BMI2;
+#endif
+
+	DBGPRINT("CPU features: 0x%X%s\n", hcpu_features, hcpu_portable ? ", not used" : "");
+
+	if (hcpu_portable)
+		return;
+
+#ifdef __x86_64__
+	if (hcpu_features & HCPU_BMI2) {
+		hcpu.encode = hencode_bmi2;
+		hcpu.decode = hdecode_bmi2;
+		hcpu.decode_streams = hdecode_streams_bmi2;
+	}
+#endif
+
+	FUNC_LEAVE();
+}
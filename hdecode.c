@@ -0,0 +1,732 @@
+/*
+ * @file   hdecode.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Table driven Huffman decoder
+*/
+
+#include <hdecode.h>
+#include <hbits.h>
+#include <hcpu.h>
+#include <assert.h>
+
+#if HDMULTI_BITS < HDECODE_BITS
+#error "Multi-symbol table should be wider than the first level table"
+#endif
+
+/**
+ * @brief Fill range of table with the same entry
+ */
+static inline void hdtable_fill( uint32_t *entries, uint32_t start, uint32_t count, uint32_t entry) {
+	for (uint32_t i=0; i<count; i++)
+		entries[start + i] = entry;
+}
+
+/**
+ * @brief Build decoding table from codes
+ *
+ * Codes are MSB-first, as they are written to stream.
+ * Entries are allocated from arena and released with it.
+ *
+ * @param table Table to be filled
+ * @param codes Code for every symbol of dictionary
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param arena Arena for entries of table
+ *
+ * @return zero on success
+ */
+int hdtable_build( hdtable_t *table, const uint32_t *codes, const uint8_t *lengths,
+		harena_t *arena) {
+
+	FUNC_ENTER();
+
+	uint8_t width[1 << HDECODE_BITS]; /**< width of second level table for prefix */
+	uint32_t size = 1 << HDECODE_BITS;
+	uint32_t maxlen = 0;
+
+	assert( table != NULL);
+	assert( codes != NULL);
+	assert( lengths != NULL);
+	assert( arena != NULL);
+
+	memset( width, 0, sizeof(width));
+
+	/* Check codes and count space for second level tables */
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		uint32_t len = lengths[sym];
+
+		if (len == 0)
+			continue;
+
+		if ((len > HDECODE_MAX_BITS) || (((uint64_t) codes[sym] >> len) != 0)) {
+			DBGPRINT("Wrong code 0x%X (%u) for symbol %u\n", codes[sym], len, sym);
+			return -1;
+		}
+
+		if (len > maxlen)
+			maxlen = len;
+
+		if (len > HDECODE_BITS) {
+			uint32_t prefix = codes[sym] >> (len - HDECODE_BITS);
+
+			if (len - HDECODE_BITS > width[prefix])
+				width[prefix] = len - HDECODE_BITS;
+		}
+	}
+
+	for (uint32_t prefix=0; prefix < (1 << HDECODE_BITS); prefix++) {
+		if (width[prefix] != 0)
+			size += 1 << width[prefix];
+	}
+
+	table->entries = harena_alloc( arena, size * sizeof(uint32_t));
+	if (table->entries == NULL)
+		return -1;
+
+	table->size = size;
+	table->maxlen = maxlen;
+	table->multi = NULL;
+
+	/* Holes of incomplete code consume 1 bit and mark stream as broken */
+	hdtable_fill( table->entries, 0, size, HDENTRY_INVALID | 1);
+
+	/* Short codes occupy all entries starting with the code */
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		uint32_t len = lengths[sym];
+
+		if ((len == 0) || (len > HDECODE_BITS))
+			continue;
+
+		hdtable_fill( table->entries, codes[sym] << (HDECODE_BITS - len),
+				1 << (HDECODE_BITS - len), (sym << HDENTRY_SHIFT) | len);
+	}
+
+	/* Links to second level tables */
+	uint32_t offset = 1 << HDECODE_BITS;
+	for (uint32_t prefix=0; prefix < (1 << HDECODE_BITS); prefix++) {
+		if (width[prefix] == 0)
+			continue;
+
+		table->entries[prefix] = (offset << HDENTRY_SHIFT) | HDENTRY_LINK | width[prefix];
+		offset += 1 << width[prefix];
+	}
+
+	/* Long codes */
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		uint32_t len = lengths[sym];
+
+		if (len <= HDECODE_BITS)
+			continue;
+
+		uint32_t sublen = len - HDECODE_BITS;
+		/* Prefix of every long code got its link above */
+		uint32_t link = table->entries[codes[sym] >> sublen];
+		uint32_t subwidth = link & HDENTRY_LEN_MASK;
+		uint32_t sub = codes[sym] & ((1 << sublen) - 1);
+
+		hdtable_fill( table->entries, (link >> HDENTRY_SHIFT) + (sub << (subwidth - sublen)),
+				1 << (subwidth - sublen), (sym << HDENTRY_SHIFT) | len);
+	}
+
+	FUNC_LEAVE();
+
+	return 0;
+}
+
+/**
+ * @brief Check if multi-symbol table pays for its building
+ *
+ * Probability of symbol is estimated as 2^-length of its code,
+ * table is built for short mean length of code and large output.
+ *
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return non-zero if table should be built
+ */
+int hdtable_multi_pays( const uint8_t *lengths, size_t out_size) {
+
+	uint64_t weight = 0; /**< sum of probabilities, 1 is 1 << HDECODE_MAX_BITS */
+	uint64_t bits = 0;
+
+	if (out_size < HDMULTI_MIN_SIZE)
+		return 0;
+
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		uint32_t len = lengths[sym];
+
+		if ((len == 0) || (len > HDECODE_MAX_BITS))
+			continue;
+
+		weight += (uint64_t) 1 << (HDECODE_MAX_BITS - len);
+		bits += (uint64_t) len << (HDECODE_MAX_BITS - len);
+	}
+
+	return (weight != 0) && (bits * 16 <= weight * HDMULTI_MEAN_MAX);
+}
+
+/**
+ * @brief Add multi-symbol table to decoding table
+ *
+ * Decoders use it if it is present.
+ *
+ * @param table Table built by hdtable_build()
+ * @param arena Arena for entries of table
+ *
+ * @return zero on success
+ */
+int hdtable_build_multi( hdtable_t *table, harena_t *arena) {
+
+	FUNC_ENTER();
+
+	assert( table != NULL);
+	assert( arena != NULL);
+
+	uint32_t *multi = harena_alloc( arena, (1 << HDMULTI_BITS) * sizeof(uint32_t));
+	if (multi == NULL)
+		return -1;
+
+	for (uint32_t window=0; window < (1 << HDMULTI_BITS); window++) {
+		uint32_t entry = 0;
+		uint32_t used = 0;
+		uint32_t count = 0;
+
+		/* Codes are taken while they fit, bits after the window are zeroes */
+		while (count < HDMULTI_SYMBOLS) {
+			uint32_t rest = (window << used) & ((1 << HDMULTI_BITS) - 1);
+			uint32_t e = table->entries[rest >> (HDMULTI_BITS - HDECODE_BITS)];
+			uint32_t len = e & HDENTRY_LEN_MASK;
+
+			/* Long and broken codes are resolved by the main table */
+			if ((e & (HDENTRY_LINK | HDENTRY_INVALID)) || (used + len > HDMULTI_BITS))
+				break;
+
+			entry |= (e >> HDENTRY_SHIFT) << (24 - 8 * count);
+			used += len;
+			count++;
+		}
+
+		multi[window] = entry | (count << HDMULTI_COUNT_SHIFT) | used;
+	}
+
+	table->multi = multi;
+
+	FUNC_LEAVE();
+
+	return 0;
+}
+
+/**
+ * @brief Prepare decoder context
+ *
+ * @param ctx Context
+ *
+ * @return zero on success
+ */
+int hdctx_init( hdctx_t *ctx) {
+
+	assert( ctx != NULL);
+
+	ctx->valid = 0;
+	ctx->buffer = malloc( HDCTX_ARENA_SIZE);
+	if (ctx->buffer == NULL)
+		return -1;
+
+	harena_init( &ctx->arena, ctx->buffer, HDCTX_ARENA_SIZE);
+
+	return 0;
+}
+
+/**
+ * @brief Release memory of decoder context
+ *
+ * @param ctx Context
+ */
+void hdctx_destroy( hdctx_t *ctx) {
+
+	assert( ctx != NULL);
+
+	harena_reset( &ctx->arena);
+	free( ctx->buffer);
+	ctx->buffer = NULL;
+	ctx->valid = 0;
+}
+
+/**
+ * @brief Get decoding table for codes
+ *
+ * Table of the previous call is returned if codes are the same,
+ * otherwise table is rebuilt in memory of context. Multi-symbol
+ * table is added if it pays for output of out_size symbols.
+ * Table is valid until the next call.
+ *
+ * @param ctx Context
+ * @param codes Code for every symbol of dictionary
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return Table or NULL for broken codes
+ */
+const hdtable_t *hdctx_table( hdctx_t *ctx, const uint32_t *codes, const uint8_t *lengths,
+		size_t out_size) {
+
+	FUNC_ENTER();
+
+	assert( ctx != NULL);
+
+	/* Frames reusing table of the previous frame come one after another */
+	if (!ctx->valid || (memcmp( ctx->lengths, lengths, sizeof(ctx->lengths)) != 0) ||
+			(memcmp( ctx->codes, codes, sizeof(ctx->codes)) != 0)) {
+
+		ctx->valid = 0;
+		harena_reset( &ctx->arena);
+
+		if (hdtable_build( &ctx->table, codes, lengths, &ctx->arena) != 0)
+			return NULL;
+
+		memcpy( ctx->lengths, lengths, sizeof(ctx->lengths));
+		memcpy( ctx->codes, codes, sizeof(ctx->codes));
+		ctx->valid = 1;
+	} else {
+		DBGPRINT("Table of the previous block is reused\n");
+	}
+
+	/* Built table is kept even if block is smaller than HDMULTI_MIN_SIZE */
+	if ((ctx->table.multi == NULL) && hdtable_multi_pays( lengths, out_size))
+		hdtable_build_multi( &ctx->table, &ctx->arena);
+
+	FUNC_LEAVE();
+
+	return &ctx->table;
+}
+
+/**
+ * @brief State of bit reader
+ */
+typedef struct hdstream {
+	const uint8_t *start; /**< beginning of stream */
+	const uint8_t *in; /**< next byte to be loaded */
+	const uint8_t *end; /**< end of stream */
+	uint64_t bitbuf; /**< not consumed bits, MSB-first */
+	int bitcnt; /**< count of valid bits in bitbuf */
+} hdstream_t;
+
+/**
+ * @brief Attach reader to stream
+ *
+ * @param s Reader
+ * @param zdata Stream data
+ * @param bits Size of stream in bits
+ */
+HCPU_KERNEL void hdstream_init( hdstream_t *s, const uint8_t *zdata, uint64_t bits) {
+	s->start = zdata;
+	s->in = zdata;
+	s->end = zdata + (bits%8 ? (1 + bits/8) : (bits/8));
+	s->bitbuf = 0;
+	s->bitcnt = 0;
+}
+
+/**
+ * @brief Count of bits consumed so far
+ */
+HCPU_KERNEL uint64_t hdstream_pos( const hdstream_t *s) {
+	return (uint64_t) (s->in - s->start) * 8 - s->bitcnt;
+}
+
+/**
+ * @brief Refill bit buffer with whole word, at least 56 bits available after
+ *
+ * 8 bytes should be available for reading at s->in.
+ */
+HCPU_KERNEL void hdstream_refill_fast( hdstream_t *s) {
+	s->bitbuf |= load_be64( s->in) >> s->bitcnt;
+	s->in += (63 - s->bitcnt) >> 3;
+	s->bitcnt |= 56;
+}
+
+/**
+ * @brief Refill bit buffer byte by byte, zeroes are read beyond the end
+ */
+HCPU_KERNEL void hdstream_refill( hdstream_t *s) {
+	while (s->bitcnt <= 56) {
+		uint64_t byte = (s->in < s->end) ? *s->in : 0;
+		s->bitbuf |= byte << (56 - s->bitcnt);
+		s->bitcnt += 8;
+		s->in++;
+	}
+}
+
+/**
+ * @brief Resolve one symbol from the top of bit buffer
+ *
+ * @param s Reader
+ * @param entries Decoding table
+ * @param err Accumulator of flags of used entries
+ *
+ * @return Decoded symbol
+ */
+HCPU_KERNEL uint8_t hdstream_symbol( hdstream_t *s, const uint32_t *entries, uint32_t *err) {
+	uint32_t e = entries[s->bitbuf >> (64 - HDECODE_BITS)];
+
+	if (e & HDENTRY_LINK) {
+		e = entries[(e >> HDENTRY_SHIFT) +
+			((s->bitbuf << HDECODE_BITS) >> (64 - (e & HDENTRY_LEN_MASK)))];
+	}
+	*err |= e;
+	s->bitbuf <<= e & HDENTRY_LEN_MASK;
+	s->bitcnt -= e & HDENTRY_LEN_MASK;
+
+	return (uint8_t) (e >> HDENTRY_SHIFT);
+}
+
+/**
+ * @brief Resolve several symbols from the top of bit buffer
+ *
+ * All bits of HDMULTI_BITS window should belong to stream.
+ * Up to HDMULTI_SYMBOLS symbols are always written.
+ *
+ * @param s Reader
+ * @param table Decoding table with multi-symbol table
+ * @param out Output for the first symbol
+ * @param stride Distance between symbols in output
+ * @param err Accumulator of flags of used entries
+ *
+ * @return Count of decoded symbols
+ */
+HCPU_KERNEL uint32_t hdstream_multi( hdstream_t *s, const hdtable_t *table,
+		uint8_t *out, size_t stride, uint32_t *err) {
+
+	uint32_t e = table->multi[s->bitbuf >> (64 - HDMULTI_BITS)];
+	uint32_t count = (e >> HDMULTI_COUNT_SHIFT) & HDMULTI_COUNT_MASK;
+
+	if (count == 0) {
+		*out = hdstream_symbol( s, table->entries, err);
+		return 1;
+	}
+
+	out[0] = (uint8_t) (e >> 24);
+	out[stride] = (uint8_t) (e >> 16);
+	out[2 * stride] = (uint8_t) (e >> 8);
+
+	s->bitbuf <<= e & HDMULTI_LEN_MASK;
+	s->bitcnt -= e & HDMULTI_LEN_MASK;
+
+	return count;
+}
+
+/**
+ * @brief Decode bit stream, body of all variants of hdecode()
+ *
+ * @param table Decoding table
+ * @param zdata Compressed data
+ * @param zdata_size Size of compressed data in bits
+ * @param out Buffer for decoded data
+ * @param out_size Size of buffer
+ *
+ * @return Count of decoded bytes or -1 for corrupted data
+ */
+HCPU_KERNEL int64_t hdecode_kernel( const hdtable_t *table, const uint8_t *zdata, uint64_t zdata_size,
+		uint8_t *out, size_t out_size) {
+
+	FUNC_ENTER();
+
+	const uint32_t *entries = table->entries;
+	uint8_t *start = out;
+	uint8_t *out_end = out + out_size;
+	hdstream_t s;
+	uint32_t err = 0; /**< collects flags of all used entries */
+
+	assert( table->maxlen <= HDECODE_MAX_BITS);
+
+	if (table->maxlen == 0)
+		return (zdata_size == 0) ? 0 : -1;
+
+	hdstream_init( &s, zdata, zdata_size);
+
+	/* After refill at least 56 bits are available */
+	uint32_t group = 56 / table->maxlen;
+	uint64_t limit = (uint64_t) group * table->maxlen;
+
+	/* Fast path: whole word refill and several symbols per refill */
+	while ((table->multi == NULL) && (s.in + sizeof(uint64_t) <= s.end) &&
+			(hdstream_pos( &s) + limit <= zdata_size) && (out + group <= out_end)) {
+
+		hdstream_refill_fast( &s);
+
+		for (uint32_t i=0; i<group; i++)
+			*out++ = hdstream_symbol( &s, entries, &err);
+	}
+
+	if (table->multi != NULL) {
+		/* Window of lookup is inside of stream, codes after the window are not read */
+		uint32_t width = (table->maxlen > HDMULTI_BITS) ? table->maxlen : HDMULTI_BITS;
+
+		group = 56 / width;
+		limit = (uint64_t) group * width;
+
+		while ((s.in + sizeof(uint64_t) <= s.end) && (hdstream_pos( &s) + limit <= zdata_size) &&
+				(out + group * HDMULTI_SYMBOLS <= out_end)) {
+
+			hdstream_refill_fast( &s);
+
+			for (uint32_t i=0; i<group; i++)
+				out += hdstream_multi( &s, table, out, 1, &err);
+		}
+	}
+
+	/* The rest of stream */
+	while (hdstream_pos( &s) < zdata_size) {
+		if (out == out_end)
+			return -1;
+		hdstream_refill( &s);
+		*out++ = hdstream_symbol( &s, entries, &err);
+	}
+
+	if ((err & HDENTRY_INVALID) || (hdstream_pos( &s) != zdata_size)) {
+		DBGPRINT("Corrupted stream detected\n");
+		return -1;
+	}
+
+	FUNC_LEAVE();
+
+	return out - start;
+}
+
+/**
+ * @brief Decode interleaved bit streams with multi-symbol table
+ *
+ * Streams yield different count of symbols per lookup, so every
+ * stream has own position in output.
+ *
+ * @param table Decoding table with multi-symbol table
+ * @param zdata Compressed data
+ * @param streams_bits Size of every stream in bits
+ * @param out Buffer for decoded data
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return zero on success or -1 for corrupted data
+ */
+HCPU_KERNEL int hdecode_streams_multi( const hdtable_t *table, const uint8_t *zdata, const uint32_t *streams_bits,
+		uint8_t *out, size_t out_size) {
+
+	hdstream_t s[ZSTREAMS];
+	uint32_t err = 0; /**< collects flags of all used entries */
+	size_t pos[ZSTREAMS];
+
+	for (uint32_t i=0; i<ZSTREAMS; i++) {
+		hdstream_init( &s[i], zdata, streams_bits[i]);
+		zdata = s[i].end;
+		pos[i] = i;
+	}
+
+	/* Lookups of every stream per refill */
+	uint32_t width = (table->maxlen > HDMULTI_BITS) ? table->maxlen : HDMULTI_BITS;
+	uint32_t group = 56 / width;
+
+	/*
+	 * Fast path: every stream has symbols for all lookups, so windows
+	 * are inside of streams and all written symbols are in output.
+	 */
+	while (1) {
+		int ready = 1;
+		for (uint32_t i=0; i<ZSTREAMS; i++) {
+			ready &= (s[i].in + sizeof(uint64_t) <= s[i].end) &&
+				(pos[i] + ZSTREAMS * group * HDMULTI_SYMBOLS <= out_size);
+		}
+		if (!ready)
+			break;
+
+		for (uint32_t i=0; i<ZSTREAMS; i++)
+			hdstream_refill_fast( &s[i]);
+
+		for (uint32_t g=0; g<group; g++) {
+			for (uint32_t i=0; i<ZSTREAMS; i++)
+				pos[i] += ZSTREAMS * hdstream_multi( &s[i], table, out + pos[i], ZSTREAMS, &err);
+		}
+	}
+
+	/* The rest of every stream */
+	for (uint32_t i=0; i<ZSTREAMS; i++) {
+		for (; pos[i] < out_size; pos[i] += ZSTREAMS) {
+			hdstream_refill( &s[i]);
+			out[pos[i]] = hdstream_symbol( &s[i], table->entries, &err);
+		}
+	}
+
+	if (err & HDENTRY_INVALID) {
+		DBGPRINT("Corrupted stream detected\n");
+		return -1;
+	}
+
+	for (uint32_t i=0; i<ZSTREAMS; i++) {
+		if (hdstream_pos( &s[i]) != streams_bits[i]) {
+			DBGPRINT("Stream %u: %llu bits decoded instead of %u\n", i,
+					(unsigned long long) hdstream_pos( &s[i]), streams_bits[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Decode interleaved bit streams, body of all variants of hdecode_streams()
+ *
+ * @param table Decoding table
+ * @param zdata Compressed data
+ * @param streams_bits Size of every stream in bits
+ * @param out Buffer for decoded data
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return zero on success or -1 for corrupted data
+ */
+HCPU_KERNEL int hdecode_streams_kernel( const hdtable_t *table, const uint8_t *zdata, const uint32_t *streams_bits,
+		uint8_t *out, size_t out_size) {
+
+	FUNC_ENTER();
+
+	const uint32_t *entries = table->entries;
+	hdstream_t s[ZSTREAMS];
+	uint32_t err = 0; /**< collects flags of all used entries */
+	size_t pos = 0;
+
+	assert( table->maxlen <= HDECODE_MAX_BITS);
+
+	if (table->multi != NULL)
+		return hdecode_streams_multi( table, zdata, streams_bits, out, out_size);
+
+	for (uint32_t i=0; i<ZSTREAMS; i++) {
+		hdstream_init( &s[i], zdata, streams_bits[i]);
+		zdata = s[i].end;
+	}
+
+	if (table->maxlen == 0) {
+		for (uint32_t i=0; i<ZSTREAMS; i++) {
+			if (streams_bits[i] != 0)
+				return -1;
+		}
+		return (out_size == 0) ? 0 : -1;
+	}
+
+	/* Symbols of every stream per refill */
+	uint32_t group = 56 / table->maxlen;
+	if (group > 4)
+		group = 4;
+
+	/* Fast path: all readers have whole word and every stream has group of symbols */
+	while (pos + ZSTREAMS * group <= out_size) {
+
+		int ready = 1;
+		for (uint32_t i=0; i<ZSTREAMS; i++)
+			ready &= (s[i].in + sizeof(uint64_t) <= s[i].end);
+		if (!ready)
+			break;
+
+		for (uint32_t i=0; i<ZSTREAMS; i++)
+			hdstream_refill_fast( &s[i]);
+
+		for (uint32_t g=0; g<group; g++) {
+			for (uint32_t i=0; i<ZSTREAMS; i++)
+				out[pos++] = hdstream_symbol( &s[i], entries, &err);
+		}
+	}
+
+	/* The rest of streams */
+	for (; pos < out_size; pos++) {
+		hdstream_t *cur = &s[pos % ZSTREAMS];
+
+		hdstream_refill( cur);
+		out[pos] = hdstream_symbol( cur, entries, &err);
+	}
+
+	if (err & HDENTRY_INVALID) {
+		DBGPRINT("Corrupted stream detected\n");
+		return -1;
+	}
+
+	for (uint32_t i=0; i<ZSTREAMS; i++) {
+		if (hdstream_pos( &s[i]) != streams_bits[i]) {
+			DBGPRINT("Stream %u: %llu bits decoded instead of %u\n", i,
+					(unsigned long long) hdstream_pos( &s[i]), streams_bits[i]);
+			return -1;
+		}
+	}
+
+	FUNC_LEAVE();
+
+	return 0;
+}
+
+/**
+ * @brief Decode bit stream
+ *
+ * Every code is at least 1 bit long, so out_size equal to count of
+ * bits is always enough. Stream producing more than out_size symbols
+ * is corrupted.
+ *
+ * @param table Decoding table
+ * @param zdata Compressed data
+ * @param zdata_size Size of compressed data in bits
+ * @param out Buffer for decoded data
+ * @param out_size Size of buffer
+ *
+ * @return Count of decoded bytes or -1 for corrupted data
+ */
+int64_t hdecode( const hdtable_t *table, const uint8_t *zdata, uint64_t zdata_size,
+		uint8_t *out, size_t out_size) {
+
+	return hdecode_kernel( table, zdata, zdata_size, out, out_size);
+}
+
+/**
+ * @brief Decode ZSTREAMS interleaved bit streams
+ *
+ * Symbol N of output is taken from stream (N % ZSTREAMS), streams
+ * are stored one after another starting from byte boundary.
+ * All streams are decoded in the same loop by independent readers,
+ * so lookups for different streams are overlapped by CPU.
+ *
+ * @param table Decoding table
+ * @param zdata Compressed data
+ * @param streams_bits Size of every stream in bits
+ * @param out Buffer for decoded data
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return zero on success or -1 for corrupted data
+ */
+int hdecode_streams( const hdtable_t *table, const uint8_t *zdata, const uint32_t *streams_bits,
+		uint8_t *out, size_t out_size) {
+
+	return hdecode_streams_kernel( table, zdata, streams_bits, out, out_size);
+}
+
+#ifdef __x86_64__
+
+/**
+ * @brief Decode bit stream, BMI2 variant
+ *
+ * hdecode() compiled for BMI2, consumed bits and second level
+ * entries are shifted by shlx/shrx.
+ *
+ * Parameters are the same as for hdecode().
+ */
+HCPU_TARGET("bmi2") int64_t hdecode_bmi2( const hdtable_t *table, const uint8_t *zdata, uint64_t zdata_size,
+		uint8_t *out, size_t out_size) {
+
+	return hdecode_kernel( table, zdata, zdata_size, out, out_size);
+}
+
+/**
+ * @brief Decode ZSTREAMS interleaved bit streams, BMI2 variant
+ *
+ * hdecode_streams() compiled for BMI2.
+ *
+ * Parameters are the same as for hdecode_streams().
+ */
+HCPU_TARGET("bmi2") int hdecode_streams_bmi2( const hdtable_t *table, const uint8_t *zdata,
+		const uint32_t *streams_bits, uint8_t *out, size_t out_size) {
+
+	return hdecode_streams_kernel( table, zdata, streams_bits, out, out_size);
+}
+
+#endif /* __x86_64__ */
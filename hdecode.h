@@ -0,0 +1,228 @@
+/*
+ * @file   hdecode.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Table driven Huffman decoder
+ *
+ * Codes are resolved by peeking HDECODE_BITS bits from 64-bit
+ * bit buffer. One lookup returns symbol and length of code,
+ * longer codes are resolved with the second level table
+ * linked from the first level entry.
+ *
+ * Tables with short codes could have additional multi-symbol
+ * table: lookup of HDMULTI_BITS bits returns all codes fitting
+ * into them, up to HDMULTI_SYMBOLS symbols at once.
+*/
+
+#ifndef HDECODE_H
+#define HDECODE_H
+
+#include <huffman.h>
+#include <harena.h>
+
+/** Bits resolved by the first level lookup */
+#define HDECODE_BITS 11
+
+/** Longest supported code */
+#define HDECODE_MAX_BITS 32
+
+/*
+ * Table entry layout:
+ * bits 0..5  -- length of code (width of second level table for links)
+ * bit  6     -- invalid code
+ * bit  7     -- link to second level table
+ * bits 8..31 -- symbol (offset of second level table for links)
+ */
+#define HDENTRY_LEN_MASK 0x3F
+#define HDENTRY_INVALID  0x40
+#define HDENTRY_LINK     0x80
+#define HDENTRY_SHIFT    8
+
+/** Bits resolved by lookup in multi-symbol table */
+#define HDMULTI_BITS 12
+
+/** The most symbols resolved by one lookup in multi-symbol table */
+#define HDMULTI_SYMBOLS 3
+
+/*
+ * Multi-symbol entry layout:
+ * bits 0..3   -- length of all codes
+ * bits 4..5   -- count of symbols, 0 if the first code is longer than HDMULTI_BITS
+ * bits 8..31  -- symbols, the first one in the top byte
+ */
+#define HDMULTI_LEN_MASK    0x0F
+#define HDMULTI_COUNT_SHIFT 4
+#define HDMULTI_COUNT_MASK  0x03
+
+/** The longest mean code in 1/16 bits for multi-symbol table, two codes per lookup on average */
+#define HDMULTI_MEAN_MAX (HDMULTI_BITS*16/2)
+
+/** The smallest output for multi-symbol table, smaller blocks don't repay building */
+#define HDMULTI_MIN_SIZE (64*1024)
+
+/**
+ * @brief Decoding table
+ */
+typedef struct hdtable {
+	uint32_t *entries; /**< first level table followed by second level tables */
+	uint32_t size; /**< count of entries */
+	uint32_t maxlen; /**< the longest code in table */
+	uint32_t *multi; /**< multi-symbol table of 1 << HDMULTI_BITS entries or NULL */
+} hdtable_t;
+
+/** Memory of decoder context taken at once, enough for tables of 15-bit codes with multi-symbol table */
+#define HDCTX_ARENA_SIZE (64*1024)
+
+/**
+ * @brief Decoder context reused by consecutive blocks
+ *
+ * Context keeps the last table with codes it was built from, block
+ * coded with the same codes takes the table as is. Memory of tables
+ * is kept by context, so every thread decoding blocks should have
+ * own context.
+ */
+typedef struct hdctx {
+	hdtable_t table; /**< table built last */
+	int valid; /**< table is built */
+	uint32_t codes[DICTSIZE]; /**< codes of table */
+	uint8_t lengths[DICTSIZE]; /**< lengths of codes of table */
+	void *buffer; /**< initial memory of arena */
+	harena_t arena; /**< memory of table */
+} hdctx_t;
+
+/**
+ * @brief Build decoding table from codes
+ *
+ * Codes are MSB-first, as they are written to stream.
+ * Entries are allocated from arena and released with it.
+ *
+ * @param table Table to be filled
+ * @param codes Code for every symbol of dictionary
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param arena Arena for entries of table
+ *
+ * @return zero on success
+ */
+int hdtable_build( hdtable_t *table, const uint32_t *codes, const uint8_t *lengths,
+		harena_t *arena);
+
+/**
+ * @brief Check if multi-symbol table pays for its building
+ *
+ * Probability of symbol is estimated as 2^-length of its code,
+ * table is built for short mean length of code and large output.
+ *
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return non-zero if table should be built
+ */
+int hdtable_multi_pays( const uint8_t *lengths, size_t out_size);
+
+/**
+ * @brief Add multi-symbol table to decoding table
+ *
+ * Decoders use it if it is present.
+ *
+ * @param table Table built by hdtable_build()
+ * @param arena Arena for entries of table
+ *
+ * @return zero on success
+ */
+int hdtable_build_multi( hdtable_t *table, harena_t *arena);
+
+/**
+ * @brief Prepare decoder context
+ *
+ * @param ctx Context
+ *
+ * @return zero on success
+ */
+int hdctx_init( hdctx_t *ctx);
+
+/**
+ * @brief Release memory of decoder context
+ *
+ * @param ctx Context
+ */
+void hdctx_destroy( hdctx_t *ctx);
+
+/**
+ * @brief Get decoding table for codes
+ *
+ * Table of the previous call is returned if codes are the same,
+ * otherwise table is rebuilt in memory of context. Multi-symbol
+ * table is added if it pays for output of out_size symbols.
+ * Table is valid until the next call.
+ *
+ * @param ctx Context
+ * @param codes Code for every symbol of dictionary
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return Table or NULL for broken codes
+ */
+const hdtable_t *hdctx_table( hdctx_t *ctx, const uint32_t *codes, const uint8_t *lengths,
+		size_t out_size);
+
+/**
+ * @brief Decode bit stream
+ *
+ * Every code is at least 1 bit long, so out_size equal to count of
+ * bits is always enough. Stream producing more than out_size symbols
+ * is corrupted.
+ *
+ * @param table Decoding table
+ * @param zdata Compressed data
+ * @param zdata_size Size of compressed data in bits
+ * @param out Buffer for decoded data
+ * @param out_size Size of buffer
+ *
+ * @return Count of decoded bytes or -1 for corrupted data
+ */
+int64_t hdecode( const hdtable_t *table, const uint8_t *zdata, uint64_t zdata_size,
+		uint8_t *out, size_t out_size);
+
+/**
+ * @brief Decode ZSTREAMS interleaved bit streams
+ *
+ * Symbol N of output is taken from stream (N % ZSTREAMS), streams
+ * are stored one after another starting from byte boundary.
+ * All streams are decoded in the same loop by independent readers,
+ * so lookups for different streams are overlapped by CPU.
+ *
+ * @param table Decoding table
+ * @param zdata Compressed data
+ * @param streams_bits Size of every stream in bits
+ * @param out Buffer for decoded data
+ * @param out_size Count of symbols to be decoded
+ *
+ * @return zero on success or -1 for corrupted data
+ */
+int hdecode_streams( const hdtable_t *table, const uint8_t *zdata, const uint32_t *streams_bits,
+		uint8_t *out, size_t out_size);
+
+#ifdef __x86_64__
+/**
+ * @brief Decode bit stream, BMI2 variant
+ *
+ * hdecode() compiled for BMI2, consumed bits and second level
+ * entries are shifted by shlx/shrx.
+ *
+ * Parameters are the same as for hdecode().
+ */
+int64_t hdecode_bmi2( const hdtable_t *table, const uint8_t *zdata, uint64_t zdata_size,
+		uint8_t *out, size_t out_size);
+
+/**
+ * @brief Decode ZSTREAMS interleaved bit streams, BMI2 variant
+ *
+ * hdecode_streams() compiled for BMI2.
+ *
+ * Parameters are the same as for hdecode_streams().
+ */
+int hdecode_streams_bmi2( const hdtable_t *table, const uint8_t *zdata,
+		const uint32_t *streams_bits, uint8_t *out, size_t out_size);
+#endif
+
+#endif /* HDECODE_H */
@@ -0,0 +1,262 @@
+/*
+ * @file   hencode.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Huffman encoder
+*/
+
+#include <hencode.h>
+#include <hbits.h>
+#include <hcpu.h>
+#include <assert.h>
+
+/**
+ * @brief Pack codes and lengths into encoding table
+ *
+ * @param codes Code for every symbol of dictionary
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param[out] table Packed entry for every symbol, HENCODE_ALIGNED for lookups in whole cache lines
+ *
+ * @return The longest code in table
+ */
+uint32_t hencode_table( const uint32_t *codes, const uint8_t *lengths, uint32_t *table) {
+
+	uint32_t maxlen = 0;
+
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		assert( lengths[sym] <= HENCODE_MAX_BITS);
+
+		table[sym] = (codes[sym] << HENTRY_SHIFT) | lengths[sym];
+
+		if (lengths[sym] > maxlen)
+			maxlen = lengths[sym];
+	}
+
+	return maxlen;
+}
+
+/** Put one code to the bit buffer, bits are kept at the top */
+#define HENCODE_SYMBOL(sym) \
+	{ \
+		uint32_t e = table[sym]; \
+		bitcnt += e & HENTRY_LEN_MASK; \
+		bitbuf |= (uint64_t) (e >> HENTRY_SHIFT) << (64 - bitcnt); \
+	}
+
+/** Store the whole bit buffer, keep only incomplete byte */
+#define HENCODE_FLUSH() \
+	{ \
+		store_be64( out, bitbuf); \
+		out += bitcnt >> 3; \
+		bitbuf <<= bitcnt & ~7; \
+		bitcnt &= 7; \
+	}
+
+/**
+ * @brief Encode data, body of all variants of hencode()
+ *
+ * @param table Packed entries for every symbol
+ * @param maxlen The longest code in table
+ * @param raw Data to be encoded
+ * @param raw_size Size of data
+ * @param stride Distance between encoded symbols, 1 to encode every symbol
+ * @param zdata Output buffer, HENCODE_PAD bytes more than coded size
+ *
+ * @return Count of bits written
+ */
+HCPU_KERNEL uint64_t hencode_kernel( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata) {
+
+	FUNC_ENTER();
+
+	uint64_t bitbuf = 0; /**< not stored bits, MSB-first */
+	uint32_t bitcnt = 0; /**< count of bits in bitbuf, less than 8 after flush */
+	uint8_t *out = zdata;
+	size_t cnt = 0;
+
+	assert( (maxlen > 0) && (maxlen <= HENCODE_MAX_BITS));
+	assert( stride > 0);
+
+	/* 7 bits left from previous flush, so bit buffer never overflows */
+	uint32_t group = 56 / maxlen;
+
+	if (group >= 4) {
+		for (; cnt + 3*stride < raw_size; cnt += 4*stride) {
+			HENCODE_SYMBOL( raw[cnt]);
+			HENCODE_SYMBOL( raw[cnt+stride]);
+			HENCODE_SYMBOL( raw[cnt+2*stride]);
+			HENCODE_SYMBOL( raw[cnt+3*stride]);
+			HENCODE_FLUSH();
+		}
+	} else if (group == 3) {
+		for (; cnt + 2*stride < raw_size; cnt += 3*stride) {
+			HENCODE_SYMBOL( raw[cnt]);
+			HENCODE_SYMBOL( raw[cnt+stride]);
+			HENCODE_SYMBOL( raw[cnt+2*stride]);
+			HENCODE_FLUSH();
+		}
+	} else {
+		for (; cnt + stride < raw_size; cnt += 2*stride) {
+			HENCODE_SYMBOL( raw[cnt]);
+			HENCODE_SYMBOL( raw[cnt+stride]);
+			HENCODE_FLUSH();
+		}
+	}
+
+	for (; cnt < raw_size; cnt += stride) {
+		HENCODE_SYMBOL( raw[cnt]);
+		HENCODE_FLUSH();
+	}
+
+	/* Incomplete byte */
+	if (bitcnt != 0)
+		store_be64( out, bitbuf);
+
+	FUNC_LEAVE();
+
+	return (uint64_t) (out - zdata) * 8 + bitcnt;
+}
+
+/**
+ * @brief Encode data
+ *
+ * @param table Packed entries for every symbol
+ * @param maxlen The longest code in table
+ * @param raw Data to be encoded
+ * @param raw_size Size of data
+ * @param stride Distance between encoded symbols, 1 to encode every symbol
+ * @param zdata Output buffer, HENCODE_PAD bytes more than coded size
+ *
+ * @return Count of bits written
+ */
+uint64_t hencode( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata) {
+
+	return hencode_kernel( table, maxlen, raw, raw_size, stride, zdata);
+}
+
+/** Flag of symbol without code, above any length */
+#define HENCODE_ABSENT_FLAG 0x80
+
+/** Entry of symbol without code, 1 bit is taken to keep shift valid */
+#define HENCODE_ABSENT (HENCODE_ABSENT_FLAG | 1)
+
+/** Length in entries of hencode_count(), without flag of absent symbol */
+#define HENCODE_COUNT_LEN_MASK 0x1F
+
+/** Put one code to the bit buffer and count its symbol */
+#define HENCODE_COUNT(sym, bank) \
+	{ \
+		uint8_t s = sym; \
+		uint32_t e = entries[s]; \
+		flags |= e; \
+		banks[bank][s]++; \
+		bitcnt += e & HENCODE_COUNT_LEN_MASK; \
+		bitbuf |= (uint64_t) (e >> HENTRY_SHIFT) << (64 - bitcnt); \
+	}
+
+/**
+ * @brief Encode data and count its symbols
+ *
+ * Table is not built from data itself, so coding stops at the
+ * first symbol without code or when coded data reaches limit.
+ *
+ * @param table Packed entries for every symbol
+ * @param maxlen The longest code in table
+ * @param raw Data to be encoded
+ * @param raw_size Size of data
+ * @param stride Distance between encoded symbols, 1 to encode every symbol
+ * @param zdata Output buffer, HENCODE_PAD bytes more than limit
+ * @param limit Size of coded data in bytes to stop at
+ * @param[in,out] histogram Frequency of every coded symbol is added here
+ *
+ * @return Count of bits written or UINT64_MAX if coding is stopped
+ */
+uint64_t hencode_count( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata, size_t limit,
+		uint32_t *histogram) {
+
+	FUNC_ENTER();
+
+	uint64_t bitbuf = 0; /**< not stored bits, MSB-first */
+	uint32_t bitcnt = 0; /**< count of bits in bitbuf, less than 8 after flush */
+	uint32_t flags = 0; /**< all entries used, HENCODE_ABSENT_FLAG is set for symbol without code */
+	uint8_t *out = zdata;
+	uint8_t *end = zdata + limit;
+	size_t cnt = 0;
+
+	/* Counters of neighbour symbols don't wait for each other */
+	uint32_t banks[4][DICTSIZE];
+	uint32_t entries[DICTSIZE] HENCODE_ALIGNED;
+
+	assert( (maxlen > 0) && (maxlen <= HENCODE_MAX_BITS));
+	assert( stride > 0);
+
+	memset( banks, 0, sizeof(banks));
+
+	for (int sym=0; sym < DICTSIZE; sym++)
+		entries[sym] = (table[sym] & HENTRY_LEN_MASK) ? table[sym] : HENCODE_ABSENT;
+
+	/* Checked once per flush, bits of symbol without code are dropped */
+	if (56 / maxlen >= 4) {
+		for (; (cnt + 3*stride < raw_size) && !(flags & HENCODE_ABSENT_FLAG) && (out < end);
+				cnt += 4*stride) {
+			HENCODE_COUNT( raw[cnt], 0);
+			HENCODE_COUNT( raw[cnt+stride], 1);
+			HENCODE_COUNT( raw[cnt+2*stride], 2);
+			HENCODE_COUNT( raw[cnt+3*stride], 3);
+			HENCODE_FLUSH();
+		}
+	} else if (56 / maxlen == 3) {
+		for (; (cnt + 2*stride < raw_size) && !(flags & HENCODE_ABSENT_FLAG) && (out < end);
+				cnt += 3*stride) {
+			HENCODE_COUNT( raw[cnt], 0);
+			HENCODE_COUNT( raw[cnt+stride], 1);
+			HENCODE_COUNT( raw[cnt+2*stride], 2);
+			HENCODE_FLUSH();
+		}
+	} else {
+		for (; (cnt + stride < raw_size) && !(flags & HENCODE_ABSENT_FLAG) && (out < end);
+				cnt += 2*stride) {
+			HENCODE_COUNT( raw[cnt], 0);
+			HENCODE_COUNT( raw[cnt+stride], 1);
+			HENCODE_FLUSH();
+		}
+	}
+
+	for (; (cnt < raw_size) && !(flags & HENCODE_ABSENT_FLAG) && (out < end); cnt += stride) {
+		HENCODE_COUNT( raw[cnt], 0);
+		HENCODE_FLUSH();
+	}
+
+	if ((flags & HENCODE_ABSENT_FLAG) || (out >= end))
+		return UINT64_MAX;
+
+	for (int sym=0; sym < DICTSIZE; sym++)
+		histogram[sym] += banks[0][sym] + banks[1][sym] + banks[2][sym] + banks[3][sym];
+
+	/* Incomplete byte */
+	if (bitcnt != 0)
+		store_be64( out, bitbuf);
+
+	FUNC_LEAVE();
+
+	return (uint64_t) (out - zdata) * 8 + bitcnt;
+}
+
+#ifdef __x86_64__
+
+/**
+ * @brief Encode data, BMI2 variant
+ *
+ * hencode() compiled for BMI2, shifts by length of code are shlx.
+ *
+ * Parameters are the same as for hencode().
+ */
+HCPU_TARGET("bmi2") uint64_t hencode_bmi2( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata) {
+
+	return hencode_kernel( table, maxlen, raw, raw_size, stride, zdata);
+}
+
+#endif /* __x86_64__ */
@@ -0,0 +1,95 @@
+/*
+ * @file   hencode.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Huffman encoder
+ *
+ * Codes are taken from packed table and collected in 64-bit
+ * bit buffer, whole words are stored to output.
+*/
+
+#ifndef HENCODE_H
+#define HENCODE_H
+
+#include <huffman.h>
+
+/** Longest code supported by encoder, code and length share 32-bit word */
+#define HENCODE_MAX_BITS 24
+
+/** Output buffer should have such space after the end of data */
+#define HENCODE_PAD sizeof(uint64_t)
+
+/** Alignment of encoding table, DICTSIZE entries take whole cache lines */
+#define HENCODE_ALIGN 64
+
+/** Encoding table is declared with this attribute */
+#define HENCODE_ALIGNED __attribute__((aligned(HENCODE_ALIGN)))
+
+/*
+ * Packed table entry layout:
+ * bits 0..7  -- length of code
+ * bits 8..31 -- code, MSB-first
+ */
+#define HENTRY_LEN_MASK 0xFF
+#define HENTRY_SHIFT    8
+
+/**
+ * @brief Pack codes and lengths into encoding table
+ *
+ * @param codes Code for every symbol of dictionary
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param[out] table Packed entry for every symbol, HENCODE_ALIGNED for lookups in whole cache lines
+ *
+ * @return The longest code in table
+ */
+uint32_t hencode_table( const uint32_t *codes, const uint8_t *lengths, uint32_t *table);
+
+/**
+ * @brief Encode data
+ *
+ * @param table Packed entries for every symbol
+ * @param maxlen The longest code in table
+ * @param raw Data to be encoded
+ * @param raw_size Size of data
+ * @param stride Distance between encoded symbols, 1 to encode every symbol
+ * @param zdata Output buffer, HENCODE_PAD bytes more than coded size
+ *
+ * @return Count of bits written
+ */
+uint64_t hencode( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata);
+
+/**
+ * @brief Encode data and count its symbols
+ *
+ * Table is not built from data itself, so coding stops at the
+ * first symbol without code or when coded data reaches limit.
+ *
+ * @param table Packed entries for every symbol
+ * @param maxlen The longest code in table
+ * @param raw Data to be encoded
+ * @param raw_size Size of data
+ * @param stride Distance between encoded symbols, 1 to encode every symbol
+ * @param zdata Output buffer, HENCODE_PAD bytes more than limit
+ * @param limit Size of coded data in bytes to stop at
+ * @param[in,out] histogram Frequency of every coded symbol is added here
+ *
+ * @return Count of bits written or UINT64_MAX if coding is stopped
+ */
+uint64_t hencode_count( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata, size_t limit,
+		uint32_t *histogram);
+
+#ifdef __x86_64__
+/**
+ * @brief Encode data, BMI2 variant
+ *
+ * hencode() compiled for BMI2, shifts by length of code are shlx.
+ *
+ * Parameters are the same as for hencode().
+ */
+uint64_t hencode_bmi2( const uint32_t *table, uint32_t maxlen,
+		const uint8_t *raw, size_t raw_size, size_t stride, uint8_t *zdata);
+#endif
+
+#endif /* HENCODE_H */
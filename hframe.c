@@ -0,0 +1,253 @@
+/*
+ * @file   hframe.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Parser of compressed frames
+*/
+
+#include <hframe.h>
+#include <assert.h>
+#include <stddef.h>
+
+/* Wire types of protocol buffers */
+#define WIRE_VARINT  0
+#define WIRE_FIXED64 1
+#define WIRE_BYTES   2
+#define WIRE_FIXED32 5
+
+/**
+ * @brief Read base 128 varint
+ *
+ * @param p Pointer to current position, moved after the value
+ * @param end End of data
+ * @param[out] value Decoded value
+ *
+ * @return zero on success
+ */
+static int hframe_varint( const uint8_t **p, const uint8_t *end, uint64_t *value) {
+
+	uint64_t v = 0;
+
+	for (int shift=0; shift < 64; shift += 7) {
+		if (*p >= end)
+			return -1;
+
+		uint8_t byte = *(*p)++;
+		v |= (uint64_t) (byte & 0x7F) << shift;
+
+		if ((byte & 0x80) == 0) {
+			*value = v;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * @brief Read 32-bit varint
+ */
+static int hframe_uint32( const uint8_t **p, const uint8_t *end, uint32_t *value) {
+
+	uint64_t v;
+
+	if ((hframe_varint( p, end, &v) != 0) || (v > UINT32_MAX))
+		return -1;
+
+	*value = (uint32_t) v;
+	return 0;
+}
+
+/**
+ * @brief Read element(s) of repeated uint32 field
+ *
+ * Both packed and not packed encodings are accepted. Count grows
+ * beyond max if there are more elements, but they are not stored.
+ *
+ * @param p Pointer to current position, moved after the field
+ * @param end End of data
+ * @param wire Wire type of field
+ * @param array Storage for elements
+ * @param[in,out] count Count of elements
+ * @param max Size of storage
+ *
+ * @return zero on success
+ */
+static int hframe_repeated( const uint8_t **p, const uint8_t *end, int wire,
+		uint32_t *array, uint32_t *count, uint32_t max) {
+
+	const uint8_t *last = end;
+	uint32_t value;
+
+	if (wire == WIRE_BYTES) {
+		uint64_t len;
+
+		if ((hframe_varint( p, end, &len) != 0) || (len > (uint64_t) (end - *p)))
+			return -1;
+		last = *p + len;
+	} else if (wire != WIRE_VARINT) {
+		return -1;
+	}
+
+	do {
+		if (hframe_uint32( p, last, &value) != 0)
+			return -1;
+
+		if (*count < max)
+			array[*count] = value;
+		if (*count <= max)
+			(*count)++;
+	} while ((wire == WIRE_BYTES) && (*p < last));
+
+	return 0;
+}
+
+/**
+ * @brief Parse hpb message in place
+ *
+ * Unknown fields are skipped.
+ *
+ * @param data Message
+ * @param len Size of message
+ * @param[out] frame Parsed fields
+ *
+ * @return zero on success, -1 for malformed message
+ */
+int hframe_parse( const uint8_t *data, size_t len, hframe_t *frame) {
+
+	FUNC_ENTER();
+
+	const uint8_t *p = data;
+	const uint8_t *end = data + len;
+	int has_bits_len = 0;
+
+	assert( frame != NULL);
+
+	/* Tables are filled by counters only */
+	memset( frame, 0, offsetof(hframe_t, symbols_table));
+	frame->n_codes_table = 0;
+	frame->n_lengths_table = 0;
+
+	while (p < end) {
+		uint64_t key;
+
+		if (hframe_varint( &p, end, &key) != 0)
+			return -1;
+
+		uint32_t field = (uint32_t) (key >> 3);
+		int wire = key & 7;
+
+		const uint8_t *bytes = NULL;
+		uint32_t bytes_len = 0;
+
+		/* Length delimited fields are the same for all numbers */
+		if (wire == WIRE_BYTES && field != 3 && field != 4 && field != 5 && field != 10) {
+			uint64_t blen;
+
+			if ((hframe_varint( &p, end, &blen) != 0) || (blen > (uint64_t) (end - p)))
+				return -1;
+
+			bytes = p;
+			bytes_len = (uint32_t) blen;
+			p += blen;
+		}
+
+		switch (field) {
+			case 1:
+				if ((wire != WIRE_VARINT) || (hframe_varint( &p, end, &frame->bits_len) != 0))
+					return -1;
+				has_bits_len = 1;
+				break;
+			case 2:
+				if (wire != WIRE_BYTES)
+					return -1;
+				frame->payload = bytes;
+				frame->payload_len = bytes_len;
+				frame->has_payload = 1;
+				break;
+			case 3:
+				if (hframe_repeated( &p, end, wire, frame->symbols_table,
+							&frame->n_symbols_table, DICTSIZE) != 0)
+					return -1;
+				break;
+			case 4:
+				if (hframe_repeated( &p, end, wire, frame->codes_table,
+							&frame->n_codes_table, DICTSIZE) != 0)
+					return -1;
+				break;
+			case 5:
+				if (hframe_repeated( &p, end, wire, frame->lengths_table,
+							&frame->n_lengths_table, DICTSIZE) != 0)
+					return -1;
+				break;
+			case 6:
+				if (wire != WIRE_BYTES)
+					return -1;
+				frame->symbols_map = bytes;
+				frame->symbols_map_len = bytes_len;
+				break;
+			case 7:
+				if (wire != WIRE_BYTES)
+					return -1;
+				frame->lengths = bytes;
+				frame->lengths_len = bytes_len;
+				break;
+			case 8:
+				if (wire != WIRE_BYTES)
+					return -1;
+				frame->long_lengths = bytes;
+				frame->long_lengths_len = bytes_len;
+				break;
+			case 9:
+				if ((wire != WIRE_VARINT) || (hframe_uint32( &p, end, &frame->raw_len) != 0))
+					return -1;
+				frame->has_raw_len = 1;
+				break;
+			case 10:
+				if (hframe_repeated( &p, end, wire, frame->streams_bits,
+							&frame->n_streams_bits, ZSTREAMS) != 0)
+					return -1;
+				break;
+			case 11:
+				if ((wire != WIRE_VARINT) || (hframe_uint32( &p, end, &frame->block_size) != 0))
+					return -1;
+				frame->has_block_size = 1;
+				break;
+			case 12:
+				if ((wire != WIRE_VARINT) || (hframe_uint32( &p, end, &frame->reuse_table) != 0))
+					return -1;
+				break;
+			case 13:
+				if ((wire != WIRE_VARINT) || (hframe_uint32( &p, end, &frame->type) != 0))
+					return -1;
+				break;
+			default:
+				/* Unknown field, skip it */
+				if (wire == WIRE_VARINT) {
+					uint64_t skip;
+					if (hframe_varint( &p, end, &skip) != 0)
+						return -1;
+				} else if (wire == WIRE_FIXED64) {
+					if (end - p < 8)
+						return -1;
+					p += 8;
+				} else if (wire == WIRE_FIXED32) {
+					if (end - p < 4)
+						return -1;
+					p += 4;
+				} else if (wire != WIRE_BYTES) {
+					return -1;
+				}
+				break;
+		}
+	}
+
+	if (!has_bits_len) {
+		DBGPRINT("Required field is absent\n");
+		return -1;
+	}
+
+	FUNC_LEAVE();
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * @file   hframe.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Parser of compressed frames
+ *
+ * Frame is hpb message (see hpb.proto) preceded by its length.
+ * Message is parsed in place: payload and tables are referenced
+ * in the buffer of frame, nothing is copied or allocated.
+*/
+
+#ifndef HFRAME_H
+#define HFRAME_H
+
+#include <huffman.h>
+
+/**
+ * @brief Fields of hpb message
+ *
+ * Pointers refer to the buffer passed to hframe_parse().
+ */
+typedef struct hframe {
+	uint64_t bits_len; /**< size of payload in bits */
+	const uint8_t *payload; /**< compressed data */
+	uint32_t payload_len; /**< size of compressed data in bytes */
+	int has_payload;
+
+	const uint8_t *symbols_map; /**< bitmap of present symbols */
+	uint32_t symbols_map_len;
+	const uint8_t *lengths; /**< 4-bit lengths of codes */
+	uint32_t lengths_len;
+	const uint8_t *long_lengths; /**< 8-bit lengths of codes */
+	uint32_t long_lengths_len;
+
+	int has_raw_len;
+	uint32_t raw_len; /**< size of raw data */
+
+	int has_block_size;
+	uint32_t block_size; /**< size of blocks in stream */
+
+	uint32_t reuse_table; /**< code table of the previous frame is used */
+
+	uint32_t type; /**< type of payload, HPB_TYPE_HUFFMAN by default */
+
+	uint32_t n_streams_bits; /**< count of interleaved streams, more than ZSTREAMS is error */
+	uint32_t streams_bits[ZSTREAMS]; /**< size of every stream in bits */
+
+	/* Explicit code table of old versions */
+	uint32_t n_symbols_table;
+	uint32_t symbols_table[DICTSIZE];
+	uint32_t n_codes_table;
+	uint32_t codes_table[DICTSIZE];
+	uint32_t n_lengths_table;
+	uint32_t lengths_table[DICTSIZE];
+} hframe_t;
+
+/**
+ * @brief Parse hpb message in place
+ *
+ * Unknown fields are skipped.
+ *
+ * @param data Message
+ * @param len Size of message
+ * @param[out] frame Parsed fields
+ *
+ * @return zero on success, -1 for malformed message
+ */
+int hframe_parse( const uint8_t *data, size_t len, hframe_t *frame);
+
+#endif /* HFRAME_H */
@@ -0,0 +1,438 @@
+/*
+ * @file   hindex.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Index of blocks for random access
+*/
+
+#include <hindex.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+
+/** Write index of blocks after compressed stream */
+uint32_t hindex_enabled = 0;
+
+/** Entries allocated at once */
+#define HINDEX_CHUNK 1024
+
+/**
+ * @brief Read data from given position
+ *
+ * @return zero if all data is read
+ */
+static int hindex_pread_full( int fd, void *buffer, size_t size, uint64_t offset) {
+
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t rd = pread( fd, (uint8_t *) buffer + done, size - done, offset + done);
+
+		if (rd <= 0)
+			return -1;
+
+		done += rd;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Write all data
+ *
+ * @return zero if all data is written
+ */
+static int hindex_write_full( int fd, const void *buffer, size_t size) {
+
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t wr = write( fd, (const uint8_t *) buffer + done, size - done);
+
+		if (wr <= 0)
+			return -1;
+
+		done += wr;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Make room for entries
+ *
+ * @param index Index
+ * @param max Count of entries needed
+ *
+ * @return zero on success
+ */
+static int hindex_reserve( hindex_t *index, uint32_t max) {
+
+	if (max <= index->max)
+		return 0;
+
+	max = (max + HINDEX_CHUNK - 1) / HINDEX_CHUNK * HINDEX_CHUNK;
+
+	uint64_t *offsets = realloc( index->offsets, max * sizeof(uint64_t));
+	if (offsets == NULL)
+		return -1;
+	index->offsets = offsets;
+
+	uint64_t *raw_offsets = realloc( index->raw_offsets, max * sizeof(uint64_t));
+	if (raw_offsets == NULL)
+		return -1;
+	index->raw_offsets = raw_offsets;
+
+	uint32_t *tables = realloc( index->tables, max * sizeof(uint32_t));
+	if (tables == NULL)
+		return -1;
+	index->tables = tables;
+
+	index->max = max;
+
+	return 0;
+}
+
+/**
+ * @brief Create empty index
+ *
+ * @param[out] index Index
+ *
+ * @return zero on success
+ */
+int hindex_init( hindex_t *index) {
+
+	assert( index != NULL);
+
+	memset( index, 0, sizeof(hindex_t));
+
+	if (hindex_reserve( index, 1) != 0) {
+		hindex_free( index);
+		return -1;
+	}
+
+	index->offsets[0] = 0;
+	index->raw_offsets[0] = 0;
+
+	return 0;
+}
+
+/**
+ * @brief Release memory of index
+ *
+ * @param index Index
+ */
+void hindex_free( hindex_t *index) {
+
+	assert( index != NULL);
+
+	free( index->offsets);
+	free( index->raw_offsets);
+	free( index->tables);
+
+	memset( index, 0, sizeof(hindex_t));
+}
+
+/**
+ * @brief Add block written after all previous ones
+ *
+ * @param index Index
+ * @param frame_len Size of frame of block in stream
+ * @param raw_len Size of raw data of block
+ * @param own_table Frame of block carries code table
+ *
+ * @return zero on success
+ */
+int hindex_add( hindex_t *index, uint64_t frame_len, uint64_t raw_len, int own_table) {
+
+	assert( index != NULL);
+
+	if ((index->count + 2 == 0) || (hindex_reserve( index, index->count + 2) != 0))
+		return -1;
+
+	uint32_t n = index->count++;
+
+	index->offsets[n + 1] = index->offsets[n] + frame_len;
+	index->raw_offsets[n + 1] = index->raw_offsets[n] + raw_len;
+	index->tables[n] = (own_table || (n == 0)) ? n : index->tables[n - 1];
+
+	return 0;
+}
+
+/**
+ * @brief Write index to the end of stream
+ *
+ * @param fd Output stream, positioned after the last block
+ * @param index Index
+ *
+ * @return zero on success
+ */
+int hindex_write( int fd, const hindex_t *index) {
+
+	FUNC_ENTER();
+
+	HpbIndex msg = HPB_INDEX__INIT;
+
+	assert( index != NULL);
+
+	msg.n_offsets = index->count + 1;
+	msg.offsets = index->offsets;
+	msg.n_raw_offsets = index->count + 1;
+	msg.raw_offsets = index->raw_offsets;
+	msg.n_tables = index->count;
+	msg.tables = index->tables;
+
+	size_t msglen = hpb_index__get_packed_size( &msg);
+	size_t total = sizeof(uint32_t) + msglen + HPB_INDEX_TRAILER;
+
+	if (total > ~HPB_INDEX_FLAG)
+		return -1;
+
+	uint8_t *frame = malloc( total);
+	if (frame == NULL)
+		return -1;
+
+	/* Size with flag, message, size of the whole frame and magic */
+	uint32_t word = htonl( (uint32_t) msglen | HPB_INDEX_FLAG);
+	memcpy( frame, &word, sizeof(uint32_t));
+
+	hpb_index__pack( &msg, frame + sizeof(uint32_t));
+
+	word = htonl( (uint32_t) total);
+	memcpy( frame + total - HPB_INDEX_TRAILER, &word, sizeof(uint32_t));
+	word = htonl( HPB_INDEX_MAGIC);
+	memcpy( frame + total - sizeof(uint32_t), &word, sizeof(uint32_t));
+
+	int rc = hindex_write_full( fd, frame, total);
+
+	free( frame);
+
+	DBGPRINT("Index of %u blocks written with size %zu\n", index->count, total);
+
+	FUNC_LEAVE();
+
+	return rc;
+}
+
+/**
+ * @brief Read index from the end of file
+ *
+ * @param fd Seekable input file
+ * @param[out] index Index
+ *
+ * @return zero on success, -1 if file has no valid index
+ */
+int hindex_read( int fd, hindex_t *index) {
+
+	FUNC_ENTER();
+
+	struct stat st;
+	uint32_t trailer[2];
+	uint32_t word;
+
+	assert( index != NULL);
+
+	memset( index, 0, sizeof(hindex_t));
+
+	if ((fstat( fd, &st) != 0) || !S_ISREG( st.st_mode))
+		return -1;
+
+	uint64_t size = st.st_size;
+	if (size < sizeof(uint32_t) + HPB_INDEX_TRAILER)
+		return -1;
+
+	/* Trailer gives position of index frame */
+	if ((hindex_pread_full( fd, trailer, sizeof(trailer), size - sizeof(trailer)) != 0) ||
+			(ntohl( trailer[1]) != HPB_INDEX_MAGIC))
+		return -1;
+
+	uint64_t total = ntohl( trailer[0]);
+	if ((total < sizeof(uint32_t) + HPB_INDEX_TRAILER) || (total > size))
+		return -1;
+
+	uint64_t start = size - total;
+
+	if (hindex_pread_full( fd, &word, sizeof(uint32_t), start) != 0)
+		return -1;
+
+	word = ntohl( word);
+	if (!(word & HPB_INDEX_FLAG) ||
+			((word & ~HPB_INDEX_FLAG) + sizeof(uint32_t) + HPB_INDEX_TRAILER != total))
+		return -1;
+
+	size_t msglen = word & ~HPB_INDEX_FLAG;
+	uint8_t *buffer = malloc( msglen ? msglen : 1);
+	if (buffer == NULL)
+		return -1;
+
+	HpbIndex *msg = NULL;
+	if (hindex_pread_full( fd, buffer, msglen, start + sizeof(uint32_t)) == 0)
+		msg = hpb_index__unpack( NULL, msglen, buffer);
+
+	free( buffer);
+
+	if (msg == NULL)
+		return -1;
+
+	int rc = -1;
+	size_t n = msg->n_offsets;
+
+	if ((n == 0) || (n != msg->n_raw_offsets) || (n - 1 != msg->n_tables) || (n > UINT32_MAX) ||
+			(msg->offsets[0] != 0) || (msg->raw_offsets[0] != 0) ||
+			(msg->offsets[n - 1] > start))
+		goto out;
+
+	for (size_t i=1; i < n; i++) {
+		if ((msg->offsets[i] < msg->offsets[i - 1]) || (msg->raw_offsets[i] < msg->raw_offsets[i - 1]) ||
+				(msg->tables[i - 1] > i - 1))
+			goto out;
+	}
+
+	if (hindex_reserve( index, n) != 0)
+		goto out;
+
+	memcpy( index->offsets, msg->offsets, n * sizeof(uint64_t));
+	memcpy( index->raw_offsets, msg->raw_offsets, n * sizeof(uint64_t));
+	memcpy( index->tables, msg->tables, (n - 1) * sizeof(uint32_t));
+	index->count = n - 1;
+	/* Index follows the last block */
+	index->base = start - msg->offsets[n - 1];
+
+	DBGPRINT("Index of %u blocks read, stream starts at %llu\n", index->count,
+			(unsigned long long) index->base);
+
+	rc = 0;
+
+out:
+	hpb_index__free_unpacked( msg, NULL);
+
+	if (rc != 0)
+		hindex_free( index);
+
+	FUNC_LEAVE();
+
+	return rc;
+}
+
+/**
+ * @brief Find block containing raw data
+ *
+ * @param index Index
+ * @param offset Position in raw data, less than size of raw data
+ *
+ * @return Number of block
+ */
+uint32_t hindex_find( const hindex_t *index, uint64_t offset) {
+
+	uint32_t lo = 0;
+	uint32_t hi = index->count;
+
+	assert( index->count != 0);
+
+	/* The last block starting at or before offset */
+	while (hi - lo > 1) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (index->raw_offsets[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * @brief Read and decompress block
+ *
+ * Frame could refer to table of the previous frame, so the frame
+ * carrying that table is parsed first if chain has no table yet.
+ *
+ * @param fd Compressed file
+ * @param index Index read from this file
+ * @param i Number of block
+ * @param chain Table of the previous frame
+ * @param ctx Decoder context
+ *
+ * @return Block with raw data or NULL for corrupted file
+ */
+static hblock_t *hindex_block( int fd, const hindex_t *index, uint32_t i, hchain_t *chain,
+		hdctx_t *ctx) {
+
+	uint32_t table = index->tables[i];
+
+	if (!chain->valid && (table != i))
+		hblock_destroy( streamreader_at( fd, index->base + index->offsets[table], chain));
+
+	hblock_t *block = streamreader_at( fd, index->base + index->offsets[i], chain);
+
+	if (block == NULL)
+		return NULL;
+
+	if ((hblock_get_state( block) == ERROR) || (hblock_decompress( block, ctx) != 0) ||
+			(block->raw_size != index->raw_offsets[i + 1] - index->raw_offsets[i])) {
+		hblock_destroy( block);
+		return NULL;
+	}
+
+	return block;
+}
+
+/**
+ * @brief Decompress range of raw data
+ *
+ * Only blocks covering the range are decoded, the frame carrying
+ * code table is parsed too if the first block reuses it.
+ * Position of descriptor is not changed.
+ *
+ * @param fd Compressed file
+ * @param index Index read from this file
+ * @param[out] buffer Buffer for raw data
+ * @param size Size of range
+ * @param offset Position of range in raw data
+ * @param chain Table after the range of the previous call if this
+ *              range follows it, empty chain otherwise
+ * @param ctx Decoder context of calling thread
+ *
+ * @return Count of bytes, less than size at the end of data, or -1 for corrupted file
+ */
+int64_t hindex_pread( int fd, const hindex_t *index, uint8_t *buffer, size_t size, uint64_t offset,
+		hchain_t *chain, hdctx_t *ctx) {
+
+	FUNC_ENTER();
+
+	uint64_t end = index->raw_offsets[index->count];
+	size_t done = 0;
+
+	assert( buffer != NULL);
+	assert( chain != NULL);
+
+	if (offset >= end)
+		return 0;
+
+	if (size > end - offset)
+		size = end - offset;
+
+	for (uint32_t i = hindex_find( index, offset); done < size; i++) {
+		assert( i < index->count);
+
+		hblock_t *block = hindex_block( fd, index, i, chain, ctx);
+		if (block == NULL)
+			return -1;
+
+		uint64_t skip = offset + done - index->raw_offsets[i];
+		size_t len = block->raw_size - skip;
+
+		if (len > size - done)
+			len = size - done;
+
+		memcpy( buffer + done, block->raw + skip, len);
+		done += len;
+
+		hblock_destroy( block);
+	}
+
+	FUNC_LEAVE();
+
+	return done;
+}
@@ -0,0 +1,116 @@
+/*
+ * @file   hindex.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Index of blocks for random access
+ *
+ * Index keeps position of frame and position of raw data for
+ * every block. It is written after the last block (see hpb_index
+ * in hpb.proto) and read from the end of file, so any range of
+ * raw data is decompressed by seeking to the covering blocks.
+*/
+
+#ifndef HINDEX_H
+#define HINDEX_H
+
+#include <huffman.h>
+#include <hblock.h>
+#include <hchain.h>
+
+/** Write index of blocks after compressed stream */
+extern uint32_t hindex_enabled;
+
+/**
+ * @brief Index description
+ *
+ * Offsets have count+1 entries, the last one is the end of data.
+ */
+typedef struct hindex {
+	uint64_t *offsets; /**< position of frame from the beginning of stream */
+	uint64_t *raw_offsets; /**< position of raw data of block */
+	uint32_t *tables; /**< block carrying the last code table at block */
+	uint32_t count; /**< count of blocks */
+	uint32_t max; /**< allocated entries */
+	uint64_t base; /**< position of stream in file */
+} hindex_t;
+
+/**
+ * @brief Create empty index
+ *
+ * @param[out] index Index
+ *
+ * @return zero on success
+ */
+int hindex_init( hindex_t *index);
+
+/**
+ * @brief Release memory of index
+ *
+ * @param index Index
+ */
+void hindex_free( hindex_t *index);
+
+/**
+ * @brief Add block written after all previous ones
+ *
+ * @param index Index
+ * @param frame_len Size of frame of block in stream
+ * @param raw_len Size of raw data of block
+ * @param own_table Frame of block carries code table
+ *
+ * @return zero on success
+ */
+int hindex_add( hindex_t *index, uint64_t frame_len, uint64_t raw_len, int own_table);
+
+/**
+ * @brief Write index to the end of stream
+ *
+ * @param fd Output stream, positioned after the last block
+ * @param index Index
+ *
+ * @return zero on success
+ */
+int hindex_write( int fd, const hindex_t *index);
+
+/**
+ * @brief Read index from the end of file
+ *
+ * @param fd Seekable input file
+ * @param[out] index Index
+ *
+ * @return zero on success, -1 if file has no valid index
+ */
+int hindex_read( int fd, hindex_t *index);
+
+/**
+ * @brief Find block containing raw data
+ *
+ * @param index Index
+ * @param offset Position in raw data, less than size of raw data
+ *
+ * @return Number of block
+ */
+uint32_t hindex_find( const hindex_t *index, uint64_t offset);
+
+/**
+ * @brief Decompress range of raw data
+ *
+ * Only blocks covering the range are decoded, the frame carrying
+ * code table is parsed too if the first block reuses it.
+ * Position of descriptor is not changed.
+ *
+ * @param fd Compressed file
+ * @param index Index read from this file
+ * @param[out] buffer Buffer for raw data
+ * @param size Size of range
+ * @param offset Position of range in raw data
+ * @param chain Table after the range of the previous call if this
+ *              range follows it, empty chain otherwise
+ * @param ctx Decoder context of calling thread
+ *
+ * @return Count of bytes, less than size at the end of data, or -1 for corrupted file
+ */
+int64_t hindex_pread( int fd, const hindex_t *index, uint8_t *buffer, size_t size, uint64_t offset,
+		hchain_t *chain, hdctx_t *ctx);
+
+#endif /* HINDEX_H */
@@ -0,0 +1,470 @@
+/*
+ * @file   hio.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Asynchronous I/O of blocks with io_uring
+*/
+
+#include <hio.h>
+#include <assert.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/* Numbers are the same for all architectures */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define ATOMIC_LOAD(ptr, order) __atomic_load_n( (ptr), __ATOMIC_##order)
+#define ATOMIC_STORE(ptr, val, order) __atomic_store_n( (ptr), (val), __ATOMIC_##order)
+
+/** Use io_uring for I/O if available */
+uint32_t hio_uring = 0;
+
+/** Count of pool buffers reserved for registration: reads and writes in flight and current block */
+#define HIO_RESERVE (HIO_DEPTH * 2 + 2)
+
+/**
+ * @brief Check if buffer is registered for ring
+ */
+static inline int hio_fixed( hio_t *io, const void *buffer) {
+	return io->fixed && ((const uint8_t *) buffer >= io->pool->slab) &&
+		((const uint8_t *) buffer < io->pool->slab + io->pool->slab_size);
+}
+
+/**
+ * @brief Unmap rings and close descriptor of io_uring
+ *
+ * @param io Ring
+ */
+static void hio_release( hio_t *io) {
+
+	if ((io->sqes != NULL) && (io->sqes != MAP_FAILED))
+		munmap( io->sqes, io->sqes_size);
+	if ((io->cq_map != NULL) && (io->cq_map != MAP_FAILED) && (io->cq_map != io->sq_map))
+		munmap( io->cq_map, io->cq_map_size);
+	if ((io->sq_map != NULL) && (io->sq_map != MAP_FAILED))
+		munmap( io->sq_map, io->sq_map_size);
+	if (io->ring >= 0)
+		close( io->ring);
+
+	io->ring = -1;
+}
+
+/**
+ * @brief Set up ring for descriptor
+ *
+ * @param io Ring to be set up
+ * @param fd Descriptor to be served
+ * @param mode Direction and type of data
+ * @param pool Pool of buffers for raw data, reserved buffers are registered
+ *
+ * @return zero on success, -1 if io_uring is unavailable
+ */
+int hio_create( hio_t *io, int fd, hio_mode_t mode, hpool_t *pool) {
+
+	FUNC_ENTER();
+
+	struct io_uring_params params;
+	struct stat st;
+
+	assert( io != NULL);
+	assert( (mode != HIO_READ_RAW) || (pool != NULL));
+
+	memset( io, 0, sizeof(hio_t));
+	io->ring = -1;
+	io->fd = fd;
+	io->mode = mode;
+	io->pool = pool;
+
+	/* Order of requests matters only for pipes and terminals */
+	if ((fstat( fd, &st) == 0) && S_ISREG( st.st_mode)) {
+		off_t offset = lseek( fd, 0, SEEK_CUR);
+		if (offset >= 0) {
+			io->seekable = 1;
+			io->offset = offset;
+		}
+	}
+	io->depth = io->seekable ? HIO_DEPTH : 1;
+
+	memset( &params, 0, sizeof(params));
+	io->ring = syscall( __NR_io_uring_setup, HIO_DEPTH, &params);
+	if (io->ring < 0) {
+		DBGPRINT("io_uring is not available: %s\n", strerror( errno));
+		return -1;
+	}
+
+	io->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	io->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (io->cq_map_size > io->sq_map_size)
+			io->sq_map_size = io->cq_map_size;
+		io->cq_map_size = io->sq_map_size;
+	}
+
+	io->sq_map = mmap( NULL, io->sq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQ_RING);
+	if (io->sq_map == MAP_FAILED) {
+		hio_release( io);
+		return -1;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		io->cq_map = io->sq_map;
+	} else {
+		io->cq_map = mmap( NULL, io->cq_map_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_CQ_RING);
+		if (io->cq_map == MAP_FAILED) {
+			hio_release( io);
+			return -1;
+		}
+	}
+
+	io->sqes = mmap( NULL, io->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQES);
+	if (io->sqes == MAP_FAILED) {
+		hio_release( io);
+		return -1;
+	}
+
+	uint8_t *sq = io->sq_map;
+	uint8_t *cq = io->cq_map;
+
+	io->sq_head = (uint32_t *) (sq + params.sq_off.head);
+	io->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+	io->sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+	io->sq_array = (uint32_t *) (sq + params.sq_off.array);
+	io->cq_head = (uint32_t *) (cq + params.cq_off.head);
+	io->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+	io->cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+	io->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	/* Registered buffers save mapping of pages for every request, but are optional */
+	if (pool != NULL) {
+		if (pool->slab == NULL)
+			hpool_reserve( pool, HIO_RESERVE);
+
+		if (pool->slab != NULL) {
+			struct iovec iov = { .iov_base = pool->slab, .iov_len = pool->slab_size };
+
+			if (syscall( __NR_io_uring_register, io->ring, IORING_REGISTER_BUFFERS, &iov, 1) == 0)
+				io->fixed = 1;
+		}
+	}
+
+	DBGPRINT("io_uring for %d: depth %u, registered buffers %d\n", fd, io->depth, io->fixed);
+
+	FUNC_LEAVE();
+
+	return 0;
+}
+
+/**
+ * @brief Pass request to kernel
+ *
+ * @param io Ring
+ * @param seq Sequence number of request
+ */
+static void hio_submit( hio_t *io, uint64_t seq) {
+
+	hio_req_t *req = &io->reqs[seq % io->depth];
+
+	/* Only this thread adds entries, at most depth of them are in flight */
+	uint32_t tail = *io->sq_tail;
+	uint32_t idx = tail & *io->sq_mask;
+	struct io_uring_sqe *sqe = &io->sqes[idx];
+
+	memset( sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->fd = io->fd;
+	sqe->off = io->seekable ? req->offset : (uint64_t) -1;
+	sqe->user_data = seq;
+
+	if (req->iovcnt > 1) {
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = (uintptr_t) req->iov;
+		sqe->len = req->iovcnt;
+	} else {
+		int fixed = hio_fixed( io, req->iov[0].iov_base);
+
+		if (io->mode == HIO_READ_RAW)
+			sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		else
+			sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+
+		sqe->addr = (uintptr_t) req->iov[0].iov_base;
+		sqe->len = req->iov[0].iov_len;
+		sqe->buf_index = 0;
+	}
+
+	io->sq_array[idx] = idx;
+	ATOMIC_STORE( io->sq_tail, tail + 1, RELEASE);
+
+	while (syscall( __NR_io_uring_enter, io->ring, 1, 0, 0, NULL, 0) < 0) {
+		if ((errno != EINTR) && (errno != EAGAIN)) {
+			perror("io_uring_enter");
+			exit( 1);
+		}
+	}
+}
+
+/**
+ * @brief Skip transferred part of request
+ *
+ * @param req Request
+ * @param len Count of transferred bytes
+ */
+static void hio_advance( hio_req_t *req, size_t len) {
+
+	req->done += len;
+	req->offset += len;
+
+	while ((req->iovcnt != 0) && (len >= req->iov[0].iov_len)) {
+		len -= req->iov[0].iov_len;
+		req->iovcnt--;
+		memmove( req->iov, req->iov + 1, req->iovcnt * sizeof(struct iovec));
+	}
+
+	if (req->iovcnt != 0) {
+		req->iov[0].iov_base = (uint8_t *) req->iov[0].iov_base + len;
+		req->iov[0].iov_len -= len;
+	}
+}
+
+/**
+ * @brief Wait for completion of any request and handle it
+ *
+ * Partially transferred requests are submitted again for the rest.
+ *
+ * @param io Ring
+ */
+static void hio_complete( hio_t *io) {
+
+	uint32_t head = *io->cq_head;
+
+	while (head == ATOMIC_LOAD( io->cq_tail, ACQUIRE)) {
+		if ((syscall( __NR_io_uring_enter, io->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) &&
+				(errno != EINTR)) {
+			perror("io_uring_enter");
+			exit( 1);
+		}
+	}
+
+	struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+	uint64_t seq = cqe->user_data;
+	int32_t res = cqe->res;
+
+	ATOMIC_STORE( io->cq_head, head + 1, RELEASE);
+
+	hio_req_t *req = &io->reqs[seq % io->depth];
+
+	if ((res == -EINTR) || (res == -EAGAIN)) {
+		hio_submit( io, seq);
+		return;
+	}
+
+	if (io->mode == HIO_READ_RAW) {
+		if (res < 0) {
+			errno = -res;
+			perror("Failed to read input");
+		}
+
+		if (res <= 0) {
+			/* Nothing more to read, following requests are finished with EOF too */
+			io->eof = 1;
+			req->complete = 1;
+			return;
+		}
+	} else if (res <= 0) {
+		errno = res ? -res : EIO;
+		perror("write failed");
+		exit( 1);
+	}
+
+	hio_advance( req, res);
+
+	if (req->iovcnt != 0) {
+		hio_submit( io, seq);
+		return;
+	}
+
+	req->complete = 1;
+
+	/* Written block is not needed anymore */
+	if (req->block != NULL) {
+		hblock_destroy( req->block);
+		req->block = NULL;
+	}
+}
+
+/**
+ * @brief Wait for the oldest request and remove it from ring
+ *
+ * @param io Ring
+ *
+ * @return Finished request, valid until the next request is added
+ */
+static hio_req_t *hio_wait( hio_t *io) {
+
+	assert( io->tail != io->head);
+
+	hio_req_t *req = &io->reqs[io->tail % io->depth];
+
+	while (!req->complete)
+		hio_complete( io);
+
+	io->tail++;
+
+	return req;
+}
+
+/**
+ * @brief Finish all requests and release ring
+ *
+ * Blocks being written are destroyed after writing.
+ *
+ * @param io Ring
+ */
+void hio_destroy( hio_t *io) {
+
+	FUNC_ENTER();
+
+	assert( io != NULL);
+
+	while (io->tail != io->head) {
+		hio_req_t *req = hio_wait( io);
+
+		/* Read ahead buffers are not needed */
+		if (req->buffer != NULL)
+			hpool_put( io->pool, req->buffer);
+	}
+
+	/* Descriptor is left right after transferred data */
+	if (io->seekable)
+		lseek( io->fd, io->offset, SEEK_SET);
+
+	hio_release( io);
+
+	FUNC_LEAVE();
+}
+
+/**
+ * @brief Get the next raw block
+ *
+ * Reads of the following blocks are submitted before return.
+ *
+ * @param io Ring in HIO_READ_RAW mode
+ *
+ * @return Block with hblock_size bytes or less at the end of input,
+ *         NULL at the end of input
+ */
+hblock_t *hio_read_block( hio_t *io) {
+
+	FUNC_ENTER();
+
+	assert( io != NULL);
+	assert( io->mode == HIO_READ_RAW);
+
+	while (1) {
+		/* Keep ring full */
+		while (!io->eof && (io->head - io->tail < io->depth)) {
+			hio_req_t *req = &io->reqs[io->head % io->depth];
+
+			memset( req, 0, sizeof(hio_req_t));
+			req->buffer = hpool_get( io->pool);
+			assert( req->buffer != NULL);
+
+			req->iov[0].iov_base = req->buffer;
+			req->iov[0].iov_len = hblock_size;
+			req->iovcnt = 1;
+			req->offset = io->offset;
+			io->offset += hblock_size;
+
+			hio_submit( io, io->head++);
+		}
+
+		if (io->tail == io->head)
+			return NULL;
+
+		hio_req_t *req = hio_wait( io);
+		uint8_t *buffer = req->buffer;
+
+		req->buffer = NULL;
+
+		if (req->done == 0) {
+			hpool_put( io->pool, buffer);
+			continue;
+		}
+
+		DBGPRINT("Read block of %zu size\n", req->done);
+
+		hblock_t *block = hblock_adopt( buffer, req->done, RAW_READY, io->pool);
+		assert( block != NULL);
+
+		FUNC_LEAVE();
+
+		return block;
+	}
+}
+
+/**
+ * @brief Submit writing of block
+ *
+ * Block is owned by ring and destroyed after it is written.
+ *
+ * @param io Ring in HIO_WRITE_RAW or HIO_WRITE_FRAMES mode
+ * @param block Processed block
+ *
+ * @return Count of bytes to be written
+ */
+size_t hio_write_block( hio_t *io, hblock_t *block) {
+
+	FUNC_ENTER();
+
+	size_t len;
+
+	assert( io != NULL);
+	assert( io->mode != HIO_READ_RAW);
+	assert( block != NULL);
+
+	if (io->head - io->tail == io->depth)
+		hio_wait( io);
+
+	hio_req_t *req = &io->reqs[io->head % io->depth];
+
+	memset( req, 0, sizeof(hio_req_t));
+
+	if (io->mode == HIO_WRITE_FRAMES) {
+		len = hblock_frame( block, req->iov);
+		req->iovcnt = HBLOCK_FRAME_IOV;
+	} else {
+		len = (block->raw != NULL) ? block->raw_size : 0;
+		req->iov[0].iov_base = block->raw;
+		req->iov[0].iov_len = len;
+		req->iovcnt = 1;
+	}
+
+	if (len == 0) {
+		hblock_destroy( block);
+		return 0;
+	}
+
+	req->block = block;
+	req->offset = io->offset;
+	io->offset += len;
+
+	hio_submit( io, io->head++);
+
+	FUNC_LEAVE();
+
+	return len;
+}
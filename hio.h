@@ -0,0 +1,139 @@
+/*
+ * @file   hio.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Asynchronous I/O of blocks with io_uring
+ *
+ * Reading of raw blocks and writing of blocks are submitted to
+ * io_uring and several requests are kept in flight, so waiting for
+ * device overlaps with compression even without threads. Every
+ * ring serves one descriptor in one direction and is used by one
+ * thread only. Ring is set up with bare syscalls, so no library is
+ * needed, and callers fall back to read()/write() if it fails.
+ *
+ * Regular files are accessed with explicit offsets and allow
+ * HIO_DEPTH requests in flight, pipes are served by one request
+ * at time to keep order of data.
+*/
+
+#ifndef HIO_H
+#define HIO_H
+
+#include <huffman.h>
+#include <hblock.h>
+#include <linux/io_uring.h>
+
+/** Maximal count of requests in flight */
+#define HIO_DEPTH 4
+
+/** Use io_uring for I/O if available */
+extern uint32_t hio_uring;
+
+/**
+ * @brief What ring does with blocks
+ */
+enum hio_mode {
+	HIO_READ_RAW,     /**< read raw blocks of hblock_size bytes */
+	HIO_WRITE_RAW,    /**< write raw data of blocks */
+	HIO_WRITE_FRAMES  /**< write frames of compressed blocks */
+};
+
+typedef enum hio_mode hio_mode_t;
+
+/**
+ * @brief Request in flight
+ */
+typedef struct hio_req {
+	hblock_t *block; /**< block being written */
+	uint8_t *buffer; /**< buffer being read */
+	struct iovec iov[HBLOCK_FRAME_IOV]; /**< not transferred part of data */
+	uint32_t iovcnt; /**< count of not empty parts */
+	uint64_t offset; /**< position in file of not transferred data */
+	size_t done; /**< bytes transferred */
+	int complete; /**< request finished */
+} hio_req_t;
+
+/**
+ * @brief Ring with requests for one descriptor
+ */
+typedef struct hio {
+	int ring; /**< descriptor of io_uring */
+	int fd; /**< served descriptor */
+	hio_mode_t mode; /**< direction and type of data */
+	int seekable; /**< regular file, explicit offsets are used */
+	uint64_t offset; /**< position of the next request in file */
+	uint32_t depth; /**< maximal count of requests in flight */
+	int eof; /**< end of input reached, no more reads */
+	hpool_t *pool; /**< pool of buffers for reading */
+	int fixed; /**< reserved buffers of pool are registered */
+
+	/* Submission queue */
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_mask;
+	uint32_t *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/* Completion queue */
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map; /**< mapping of submission ring */
+	size_t sq_map_size;
+	void *cq_map; /**< mapping of completion ring, the same as sq_map if shared */
+	size_t cq_map_size;
+	size_t sqes_size;
+
+	uint64_t head; /**< sequence number of the next request */
+	uint64_t tail; /**< sequence number of the oldest request in flight */
+	hio_req_t reqs[HIO_DEPTH]; /**< requests, indexed by sequence number */
+} hio_t;
+
+/**
+ * @brief Set up ring for descriptor
+ *
+ * @param io Ring to be set up
+ * @param fd Descriptor to be served
+ * @param mode Direction and type of data
+ * @param pool Pool of buffers for raw data, reserved buffers are registered
+ *
+ * @return zero on success, -1 if io_uring is unavailable
+ */
+int hio_create( hio_t *io, int fd, hio_mode_t mode, hpool_t *pool);
+
+/**
+ * @brief Finish all requests and release ring
+ *
+ * Blocks being written are destroyed after writing.
+ *
+ * @param io Ring
+ */
+void hio_destroy( hio_t *io);
+
+/**
+ * @brief Get the next raw block
+ *
+ * Reads of the following blocks are submitted before return.
+ *
+ * @param io Ring in HIO_READ_RAW mode
+ *
+ * @return Block with hblock_size bytes or less at the end of input,
+ *         NULL at the end of input
+ */
+hblock_t *hio_read_block( hio_t *io);
+
+/**
+ * @brief Submit writing of block
+ *
+ * Block is owned by ring and destroyed after it is written.
+ *
+ * @param io Ring in HIO_WRITE_RAW or HIO_WRITE_FRAMES mode
+ * @param block Processed block
+ *
+ * @return Count of bytes to be written
+ */
+size_t hio_write_block( hio_t *io, hblock_t *block);
+
+#endif /* HIO_H */
@@ -0,0 +1,123 @@
+/**
+ * @file   histbench.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @brief  Benchmark of symbol frequencies counting
+ * @copyright Copyright (c) 2014, t-linux.by
+ * @license This project is released under the GNU Public License.
+ *
+ * Compares plain loop over one table with banked kernel
+ * for every file from command line.
+ */
+
+#include <huffman.h>
+#include <histogram.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+
+/* Passes over every file */
+#define PASSES 10
+
+/**
+ * @brief Current time in seconds
+ */
+static double now( void) {
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Count symbols with one table, as hblock_compress used to do
+ */
+static void histogram_plain( const uint8_t *data, size_t size, uint32_t *hist) {
+
+	memset( hist, 0, DICTSIZE * sizeof(uint32_t));
+
+	for (size_t cnt=0; cnt < size; cnt++)
+		hist[data[cnt]] += 1;
+}
+
+/**
+ * @brief Read whole file to memory
+ *
+ * @param name Name of file
+ * @param[out] size Size of file
+ *
+ * @return Buffer with data or NULL
+ */
+static uint8_t *load( const char *name, size_t *size) {
+	struct stat st;
+	uint8_t *data;
+	size_t done = 0;
+
+	int fd = open( name, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat( fd, &st) != 0) {
+		close( fd);
+		return NULL;
+	}
+
+	data = malloc( st.st_size ? st.st_size : 1);
+	assert( data != NULL);
+
+	while (done < st.st_size) {
+		ssize_t rd = read( fd, data + done, st.st_size - done);
+		if (rd <= 0)
+			break;
+		done += rd;
+	}
+
+	close( fd);
+
+	*size = done;
+	return data;
+}
+
+int main( int argc, char **argv) {
+
+	uint32_t plain[DICTSIZE], banked[DICTSIZE];
+
+	if (argc < 2) {
+		printf( "Usage: %s file [file ...]\n", argv[0]);
+		return 1;
+	}
+
+	for (int i=1; i < argc; i++) {
+		size_t size;
+		uint8_t *data = load( argv[i], &size);
+
+		if (data == NULL) {
+			perror( argv[i]);
+			return 1;
+		}
+
+		double t0 = now();
+		for (int pass=0; pass < PASSES; pass++)
+			histogram_plain( data, size, plain);
+
+		double t1 = now();
+		for (int pass=0; pass < PASSES; pass++)
+			histogram( data, size, banked);
+
+		double t2 = now();
+
+		if (memcmp( plain, banked, sizeof(plain)) != 0) {
+			printf( "%s: histograms differ!\n", argv[i]);
+			return 1;
+		}
+
+		double mb = (double) size * PASSES / (1024 * 1024);
+		printf( "%s: plain %.0f MB/s, %d banks %.0f MB/s\n", argv[i],
+				mb / (t1 - t0), HISTOGRAM_BANKS, mb / (t2 - t1));
+
+		free( data);
+	}
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * @file   histogram.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Counting of symbol frequencies
+*/
+
+#include <histogram.h>
+#include <hbits.h>
+#include <assert.h>
+
+/**
+ * @brief Count symbols into separate banks
+ *
+ * Banks are not cleared, counters are added to existing values.
+ *
+ * @param data Data to be counted
+ * @param size Size of data
+ * @param banks Sub-histogram for every position modulo HISTOGRAM_BANKS
+ */
+void histogram_banks( const uint8_t *data, size_t size, uint32_t banks[HISTOGRAM_BANKS][DICTSIZE]) {
+
+	FUNC_ENTER();
+
+	size_t pos = 0;
+
+	assert( (data != NULL) || (size == 0));
+	assert( banks != NULL);
+
+	/* Two words per iteration, the first byte of word is on the top */
+	for (; pos + 2*sizeof(uint64_t) <= size; pos += 2*sizeof(uint64_t)) {
+		uint64_t w0 = load_be64( data + pos);
+		uint64_t w1 = load_be64( data + pos + sizeof(uint64_t));
+
+		banks[0][w0 >> 56]++;
+		banks[1][(w0 >> 48) & 0xFF]++;
+		banks[2][(w0 >> 40) & 0xFF]++;
+		banks[3][(w0 >> 32) & 0xFF]++;
+		banks[4][(w0 >> 24) & 0xFF]++;
+		banks[5][(w0 >> 16) & 0xFF]++;
+		banks[6][(w0 >> 8) & 0xFF]++;
+		banks[7][w0 & 0xFF]++;
+
+		banks[0][w1 >> 56]++;
+		banks[1][(w1 >> 48) & 0xFF]++;
+		banks[2][(w1 >> 40) & 0xFF]++;
+		banks[3][(w1 >> 32) & 0xFF]++;
+		banks[4][(w1 >> 24) & 0xFF]++;
+		banks[5][(w1 >> 16) & 0xFF]++;
+		banks[6][(w1 >> 8) & 0xFF]++;
+		banks[7][w1 & 0xFF]++;
+	}
+
+	for (; pos < size; pos++)
+		banks[pos % HISTOGRAM_BANKS][data[pos]]++;
+
+	FUNC_LEAVE();
+}
+
+/**
+ * @brief Count frequency of every symbol
+ *
+ * @param data Data to be counted
+ * @param size Size of data
+ * @param[out] hist Count of every symbol of dictionary
+ */
+void histogram( const uint8_t *data, size_t size, uint32_t *hist) {
+
+	uint32_t banks[HISTOGRAM_BANKS][DICTSIZE];
+
+	assert( hist != NULL);
+
+	memset( banks, 0, sizeof(banks));
+
+	histogram_banks( data, size, banks);
+
+	for (int sym=0; sym < DICTSIZE; sym++) {
+		uint32_t sum = 0;
+
+		for (int i=0; i < HISTOGRAM_BANKS; i++)
+			sum += banks[i][sym];
+
+		hist[sym] = sum;
+	}
+}
@@ -0,0 +1,40 @@
+/*
+ * @file   histogram.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Counting of symbol frequencies
+ *
+ * Consecutive symbols are counted in separate sub-histograms (banks),
+ * so increments of the same counter do not wait for each other on
+ * data with long runs of one symbol. Banks are merged at the end.
+*/
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <huffman.h>
+
+/** Count of sub-histograms, symbol N is counted in bank (N % HISTOGRAM_BANKS) */
+#define HISTOGRAM_BANKS 8
+
+/**
+ * @brief Count symbols into separate banks
+ *
+ * Banks are not cleared, counters are added to existing values.
+ *
+ * @param data Data to be counted
+ * @param size Size of data
+ * @param banks Sub-histogram for every position modulo HISTOGRAM_BANKS
+ */
+void histogram_banks( const uint8_t *data, size_t size, uint32_t banks[HISTOGRAM_BANKS][DICTSIZE]);
+
+/**
+ * @brief Count frequency of every symbol
+ *
+ * @param data Data to be counted
+ * @param size Size of data
+ * @param[out] hist Count of every symbol of dictionary
+ */
+void histogram( const uint8_t *data, size_t size, uint32_t *hist);
+
+#endif /* HISTOGRAM_H */
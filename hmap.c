@@ -0,0 +1,79 @@
+/*
+ * @file   hmap.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Memory mapped input
+*/
+
+#include <hmap.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * @brief Map input to memory
+ *
+ * Data is mapped from the current position of descriptor
+ * to the end of file.
+ *
+ * @param fd File descriptor
+ * @param[out] map Mapping
+ *
+ * @return zero on success, -1 if input can't be mapped
+ */
+int hmap_open( int fd, hmap_t *map) {
+
+	FUNC_ENTER();
+
+	struct stat st;
+
+	assert( map != NULL);
+
+	memset( map, 0, sizeof(hmap_t));
+
+	if ((fstat( fd, &st) != 0) || !S_ISREG( st.st_mode))
+		return -1;
+
+	off_t offset = lseek( fd, 0, SEEK_CUR);
+	if ((offset < 0) || (offset >= st.st_size))
+		return -1;
+
+	if ((uint64_t) st.st_size > SIZE_MAX)
+		return -1;
+
+	void *base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED)
+		return -1;
+
+	/* Hints only, errors are not important */
+	madvise( base, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise( base, st.st_size, MADV_HUGEPAGE);
+#endif
+
+	map->base = base;
+	map->length = st.st_size;
+	map->data = map->base + offset;
+	map->size = st.st_size - offset;
+
+	DBGPRINT("Input mapped: %zu bytes\n", map->size);
+
+	FUNC_LEAVE();
+
+	return 0;
+}
+
+/**
+ * @brief Unmap input
+ *
+ * @param map Mapping
+ */
+void hmap_close( hmap_t *map) {
+
+	assert( map != NULL);
+
+	if (map->base != NULL)
+		munmap( map->base, map->length);
+
+	memset( map, 0, sizeof(hmap_t));
+}
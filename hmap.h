@@ -0,0 +1,47 @@
+/*
+ * @file   hmap.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Memory mapped input
+ *
+ * Regular files are mapped to memory and blocks are taken right
+ * from the mapping, so data is not copied by read(). Pipes and
+ * terminals can't be mapped and should be read as usual.
+*/
+
+#ifndef HMAP_H
+#define HMAP_H
+
+#include <huffman.h>
+
+/**
+ * @brief Mapping of input
+ */
+typedef struct hmap {
+	uint8_t *base; /**< start of mapping, NULL if not mapped */
+	size_t length; /**< length of mapping */
+	uint8_t *data; /**< data from current position of descriptor */
+	size_t size; /**< size of data */
+} hmap_t;
+
+/**
+ * @brief Map input to memory
+ *
+ * Data is mapped from the current position of descriptor
+ * to the end of file.
+ *
+ * @param fd File descriptor
+ * @param[out] map Mapping
+ *
+ * @return zero on success, -1 if input can't be mapped
+ */
+int hmap_open( int fd, hmap_t *map);
+
+/**
+ * @brief Unmap input
+ *
+ * @param map Mapping
+ */
+void hmap_close( hmap_t *map);
+
+#endif /* HMAP_H */
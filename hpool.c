@@ -0,0 +1,193 @@
+/*
+ * @file   hpool.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Pool of reusable buffers
+*/
+
+#include <hpool.h>
+#include <assert.h>
+
+/**
+ * @brief Check if buffer belongs to reserved region
+ */
+static inline int hpool_in_slab( hpool_t *pool, void *buffer) {
+	return (pool->slab != NULL) && ((uint8_t *) buffer >= pool->slab) &&
+		((uint8_t *) buffer < pool->slab + pool->slab_size);
+}
+
+/**
+ * @brief Create empty pool
+ *
+ * @param size Size of every buffer
+ * @param max Maximal count of free buffers kept in pool,
+ *            extra buffers are returned to heap
+ *
+ * @return Pointer to pool or NULL
+ */
+hpool_t *hpool_create( size_t size, uint32_t max) {
+
+	hpool_t *pool;
+
+	assert( size > 0);
+
+	pool = malloc( sizeof(hpool_t));
+	if (pool == NULL)
+		return NULL;
+
+	pool->free = malloc( (max ? max : 1) * sizeof(void *));
+	if (pool->free == NULL) {
+		free( pool);
+		return NULL;
+	}
+
+	pool->size = size;
+	pool->max = max;
+	pool->count = 0;
+	pool->slab = NULL;
+	pool->slab_size = 0;
+
+#ifdef _OPENMP
+	omp_init_lock( &pool->lock);
+#endif
+
+	return pool;
+}
+
+/**
+ * @brief Destroy pool and all free buffers
+ *
+ * Borrowed buffers should be returned before.
+ *
+ * @param pool Pointer to pool
+ */
+void hpool_destroy( hpool_t *pool) {
+
+	if (pool == NULL)
+		return;
+
+	for (uint32_t i=0; i < pool->count; i++) {
+		if (!hpool_in_slab( pool, pool->free[i]))
+			free( pool->free[i]);
+	}
+
+	free( pool->slab);
+
+#ifdef _OPENMP
+	omp_destroy_lock( &pool->lock);
+#endif
+
+	free( pool->free);
+	free( pool);
+}
+
+/**
+ * @brief Reserve buffers in one contiguous region
+ *
+ * Reserved buffers are never returned to heap, so the whole
+ * region could be registered for I/O once. Only one region
+ * could be reserved.
+ *
+ * @param pool Pointer to pool
+ * @param count Count of buffers
+ *
+ * @return zero on success
+ */
+int hpool_reserve( hpool_t *pool, uint32_t count) {
+
+	void *slab;
+	size_t size = (pool->size + HPOOL_ALIGN - 1) & ~((size_t) HPOOL_ALIGN - 1);
+
+	assert( pool != NULL);
+	assert( count > 0);
+
+	if (pool->slab != NULL)
+		return -1;
+
+	if (posix_memalign( &slab, HPOOL_ALIGN, size * count) != 0)
+		return -1;
+
+#ifdef _OPENMP
+	omp_set_lock( &pool->lock);
+#endif
+	/* Room for all reserved buffers in addition to max of heap ones */
+	void **stack = realloc( pool->free, (pool->max + count) * sizeof(void *));
+	if (stack != NULL) {
+		pool->free = stack;
+		pool->slab = slab;
+		pool->slab_size = size * count;
+
+		for (uint32_t i=0; i < count; i++)
+			pool->free[pool->count++] = pool->slab + i * size;
+	}
+#ifdef _OPENMP
+	omp_unset_lock( &pool->lock);
+#endif
+
+	if (stack == NULL) {
+		free( slab);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Borrow buffer from pool
+ *
+ * New buffer is allocated if pool is empty.
+ *
+ * @param pool Pointer to pool
+ *
+ * @return Buffer of pool->size bytes aligned to HPOOL_ALIGN or NULL
+ */
+void *hpool_get( hpool_t *pool) {
+
+	void *buffer = NULL;
+
+	assert( pool != NULL);
+
+#ifdef _OPENMP
+	omp_set_lock( &pool->lock);
+#endif
+	if (pool->count != 0)
+		buffer = pool->free[--pool->count];
+#ifdef _OPENMP
+	omp_unset_lock( &pool->lock);
+#endif
+
+	if (buffer == NULL) {
+		if (posix_memalign( &buffer, HPOOL_ALIGN, pool->size) != 0)
+			return NULL;
+	}
+
+	return buffer;
+}
+
+/**
+ * @brief Return buffer to pool
+ *
+ * @param pool Pointer to pool
+ * @param buffer Buffer borrowed from the same pool
+ */
+void hpool_put( hpool_t *pool, void *buffer) {
+
+	assert( pool != NULL);
+
+	if (buffer == NULL)
+		return;
+
+#ifdef _OPENMP
+	omp_set_lock( &pool->lock);
+#endif
+	if ((pool->count < pool->max) || hpool_in_slab( pool, buffer)) {
+		pool->free[pool->count++] = buffer;
+		buffer = NULL;
+	}
+#ifdef _OPENMP
+	omp_unset_lock( &pool->lock);
+#endif
+
+	/* Pool is full */
+	free( buffer);
+}
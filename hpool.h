@@ -0,0 +1,88 @@
+/*
+ * @file   hpool.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Pool of reusable buffers
+ *
+ * Buffers of the same size are borrowed by blocks and returned
+ * when blocks are destroyed, so after warm up no memory is
+ * allocated for new blocks. Pool could be shared by threads.
+*/
+
+#ifndef HPOOL_H
+#define HPOOL_H
+
+#include <huffman.h>
+
+/** Alignment of buffers, size of cache line */
+#define HPOOL_ALIGN 64
+
+/**
+ * @brief Pool description
+ */
+typedef struct hpool {
+	size_t size; /**< size of every buffer */
+	uint32_t max; /**< maximal count of free buffers kept in pool */
+	uint32_t count; /**< count of free buffers */
+	void **free; /**< stack of free buffers */
+	uint8_t *slab; /**< contiguous memory of reserved buffers, NULL if not reserved */
+	size_t slab_size; /**< size of slab */
+#ifdef _OPENMP
+	omp_lock_t lock; /**< protects stack of free buffers */
+#endif
+} hpool_t;
+
+/**
+ * @brief Create empty pool
+ *
+ * @param size Size of every buffer
+ * @param max Maximal count of free buffers kept in pool,
+ *            extra buffers are returned to heap
+ *
+ * @return Pointer to pool or NULL
+ */
+hpool_t *hpool_create( size_t size, uint32_t max);
+
+/**
+ * @brief Destroy pool and all free buffers
+ *
+ * Borrowed buffers should be returned before.
+ *
+ * @param pool Pointer to pool
+ */
+void hpool_destroy( hpool_t *pool);
+
+/**
+ * @brief Reserve buffers in one contiguous region
+ *
+ * Reserved buffers are never returned to heap, so the whole
+ * region could be registered for I/O once. Only one region
+ * could be reserved.
+ *
+ * @param pool Pointer to pool
+ * @param count Count of buffers
+ *
+ * @return zero on success
+ */
+int hpool_reserve( hpool_t *pool, uint32_t count);
+
+/**
+ * @brief Borrow buffer from pool
+ *
+ * New buffer is allocated if pool is empty.
+ *
+ * @param pool Pointer to pool
+ *
+ * @return Buffer of pool->size bytes aligned to HPOOL_ALIGN or NULL
+ */
+void *hpool_get( hpool_t *pool);
+
+/**
+ * @brief Return buffer to pool
+ *
+ * @param pool Pointer to pool
+ * @param buffer Buffer borrowed from the same pool
+ */
+void hpool_put( hpool_t *pool, void *buffer);
+
+#endif /* HPOOL_H */
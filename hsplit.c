@@ -0,0 +1,230 @@
+/*
+ * @file   hsplit.c
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Adaptive splitting of input to blocks
+*/
+
+#include <hsplit.h>
+#include <hbits.h>
+#include <assert.h>
+#include <math.h>
+
+/** Split blocks where separate code tables pay for themselves */
+uint32_t hsplit_enabled = 0;
+
+/** Bits of mantissa used as index in table of logarithms */
+#define HSPLIT_LOG_BITS 8
+
+/** Logarithms of mantissa from 1 to 2, filled by hsplit_init() */
+static double hsplit_log_table[(1 << HSPLIT_LOG_BITS) + 1];
+
+/**
+ * @brief Fast logarithm of integer
+ *
+ * Table is interpolated linearly, error is less than 1e-5.
+ *
+ * @param x Positive number
+ *
+ * @return Base 2 logarithm of x
+ */
+static inline double hsplit_log2( uint32_t x) {
+
+	uint32_t exp = 31 - __builtin_clz( x);
+	uint32_t m = x << (31 - exp); /* the highest bit of mantissa is the top */
+	uint32_t i = (m >> (31 - HSPLIT_LOG_BITS)) & ((1 << HSPLIT_LOG_BITS) - 1);
+	double frac = (m & ((1U << (31 - HSPLIT_LOG_BITS)) - 1)) * (1.0 / (1U << (31 - HSPLIT_LOG_BITS)));
+
+	return exp + hsplit_log_table[i] + (hsplit_log_table[i + 1] - hsplit_log_table[i]) * frac;
+}
+
+/**
+ * @brief Count symbols of sample of data
+ *
+ * Every HSPLIT_SAMPLE-th word is counted, it is enough to
+ * compare distributions and much faster than full histogram.
+ *
+ * @param data Data to be counted
+ * @param size Size of data
+ * @param[out] hist Count of every symbol in sample
+ */
+static void hsplit_histogram( const uint8_t *data, uint32_t size, uint32_t *hist) {
+
+	memset( hist, 0, DICTSIZE * sizeof(uint32_t));
+
+	for (uint32_t pos=0; pos + sizeof(uint64_t) <= size; pos += HSPLIT_SAMPLE * sizeof(uint64_t)) {
+		uint64_t w = load_be64( data + pos);
+
+		hist[w >> 56]++;
+		hist[(w >> 48) & 0xFF]++;
+		hist[(w >> 40) & 0xFF]++;
+		hist[(w >> 32) & 0xFF]++;
+		hist[(w >> 24) & 0xFF]++;
+		hist[(w >> 16) & 0xFF]++;
+		hist[(w >> 8) & 0xFF]++;
+		hist[w & 0xFF]++;
+	}
+}
+
+/**
+ * @brief Estimate size of frame for symbols of range of segments
+ *
+ * @param cum Histograms of all segments before the boundary, for every boundary
+ * @param present Symbols present in data
+ * @param count Count of present symbols
+ * @param lo The first segment of range
+ * @param hi Segment after the range
+ *
+ * @return Size of frame in bits
+ */
+static double hsplit_cost( uint32_t cum[][DICTSIZE], const uint8_t *present, uint32_t count,
+		uint32_t lo, uint32_t hi) {
+
+	double bits = 0;
+	uint32_t total = 0;
+	uint32_t symbols = 0;
+
+	/* Entropy: sum of c*log2(n/c) = n*log2(n) - sum of c*log2(c) */
+	for (uint32_t i=0; i < count; i++) {
+		uint32_t cnt = cum[hi][present[i]] - cum[lo][present[i]];
+
+		if (cnt == 0)
+			continue;
+
+		bits -= cnt * hsplit_log2( cnt);
+		total += cnt;
+		symbols++;
+	}
+
+	if (total != 0)
+		bits += total * hsplit_log2( total);
+
+	/* Entropy of sample is lower than entropy of data, Miller-Madow correction */
+	if (symbols != 0)
+		bits += (symbols - 1) / (2 * M_LN2);
+
+	/* Sample is HSPLIT_SAMPLE times smaller than data */
+	return bits * HSPLIT_SAMPLE + HSPLIT_FRAME_BITS + HSPLIT_TABLE_BITS( symbols);
+}
+
+/**
+ * @brief Prepare splitting of new stream
+ *
+ * @param split State of splitting
+ */
+void hsplit_init( hsplit_t *split) {
+
+	assert( split != NULL);
+
+	split->count = 0;
+
+	for (uint32_t i=0; i <= (1 << HSPLIT_LOG_BITS); i++)
+		hsplit_log_table[i] = log2( 1.0 + (double) i / (1 << HSPLIT_LOG_BITS));
+}
+
+/**
+ * @brief Find size of the first block of data
+ *
+ * Data should start at the split point returned by the previous call.
+ *
+ * @param split State of splitting
+ * @param data Raw data, up to hblock_size bytes
+ * @param size Size of data
+ *
+ * @return Size of the first block, equal to size if data should not be split
+ */
+uint32_t hsplit_find( hsplit_t *split, const uint8_t *data, uint32_t size) {
+
+	FUNC_ENTER();
+
+	uint32_t cum[HSPLIT_SEGMENTS + 2][DICTSIZE];
+	double prefix[HSPLIT_SEGMENTS + 2];
+	uint32_t offsets[HSPLIT_SEGMENTS + 2];
+	uint8_t present[DICTSIZE];
+	uint32_t symbols = 0;
+	uint32_t pos = 0;
+
+	assert( split != NULL);
+	assert( (data != NULL) || (size == 0));
+
+	uint32_t segment = size / HSPLIT_SEGMENTS;
+	if (segment < HSPLIT_SEGMENT_MIN)
+		segment = HSPLIT_SEGMENT_MIN;
+
+	/* Segments counted by the previous call are the beginning of data */
+	for (uint32_t i=0; i < split->count; i++)
+		pos += split->len[i];
+	assert( pos <= size);
+
+	/* The last segment takes the rest of data */
+	while (pos < size) {
+		uint32_t len = size - pos;
+
+		if ((len > segment) && (split->count < HSPLIT_SEGMENTS))
+			len = segment;
+
+		hsplit_histogram( data + pos, len, split->hist[split->count]);
+		split->len[split->count++] = len;
+		pos += len;
+	}
+
+	uint32_t count = split->count;
+	if (count < 2) {
+		split->count = 0;
+		return size;
+	}
+
+	memset( cum[0], 0, sizeof(cum[0]));
+	offsets[0] = 0;
+	for (uint32_t i=0; i < count; i++) {
+		for (uint32_t sym=0; sym < DICTSIZE; sym++)
+			cum[i + 1][sym] = cum[i][sym] + split->hist[i][sym];
+		offsets[i + 1] = offsets[i] + split->len[i];
+	}
+
+	/* Absent symbols are not visited by estimation */
+	for (uint32_t sym=0; sym < DICTSIZE; sym++) {
+		if (cum[count][sym] != 0)
+			present[symbols++] = sym;
+	}
+
+	for (uint32_t i=1; i <= count; i++)
+		prefix[i] = hsplit_cost( cum, present, symbols, 0, i);
+
+	/* The best single split of range, repeated for the first part while it pays */
+	uint32_t end = count;
+	while (1) {
+		uint32_t best = 0;
+		double best_cost = prefix[end] - prefix[end] / HSPLIT_MIN_GAIN;
+
+		for (uint32_t i=1; i < end; i++) {
+			if (offsets[i] < HSPLIT_BLOCK_MIN)
+				continue;
+
+			double cost = prefix[i] + hsplit_cost( cum, present, symbols, i, end);
+
+			if (cost < best_cost) {
+				best = i;
+				best_cost = cost;
+			}
+		}
+
+		if (best == 0)
+			break;
+
+		DBGPRINT("Split at segment %u of %u saves %.0f bits\n", best, end, prefix[end] - best_cost);
+
+		end = best;
+	}
+
+	/* Segments after the split point are kept for the next block */
+	pos = offsets[end];
+
+	split->count = count - end;
+	memmove( split->len, split->len + end, split->count * sizeof(split->len[0]));
+	memmove( split->hist, split->hist + end, split->count * sizeof(split->hist[0]));
+
+	FUNC_LEAVE();
+
+	return pos;
+}
@@ -0,0 +1,75 @@
+/*
+ * @file   hsplit.h
+ * @Author Denis Pynkin (d4s), denis.pynkin@t-linux.by
+ * @date   2014
+ * @brief  Adaptive splitting of input to blocks
+ *
+ * Block is divided to segments and size of compressed data is
+ * estimated from entropy of symbols plus size of frame with code
+ * table. Block is cut at the segment boundary if two separate
+ * tables give noticeably smaller output than one table for both
+ * parts, short blocks are not cut.
+ *
+ * Histograms of segments after the split point are kept for the
+ * next call, so data is counted once even if blocks are short.
+*/
+
+#ifndef HSPLIT_H
+#define HSPLIT_H
+
+#include <huffman.h>
+
+/** Split blocks where separate code tables pay for themselves */
+extern uint32_t hsplit_enabled;
+
+/** Block is divided to this count of segments, boundaries of segments are candidates for split */
+#define HSPLIT_SEGMENTS 8
+
+/** The smallest segment, smaller blocks are not split */
+#define HSPLIT_SEGMENT_MIN 4096
+
+/** Every HSPLIT_SAMPLE-th word of data is counted for estimation */
+#define HSPLIT_SAMPLE 16
+
+/** The smallest block cut from data */
+#define HSPLIT_BLOCK_MIN (32*1024)
+
+/** Split should save 1/HSPLIT_MIN_GAIN of estimated size of data at least */
+#define HSPLIT_MIN_GAIN 128
+
+/** Estimated size of frame without payload and code table in bits */
+#define HSPLIT_FRAME_BITS (48*8)
+
+/** Estimated size of code table in bits: symbols map and 4 bits per symbol */
+#define HSPLIT_TABLE_BITS(symbols) (DICTSIZE + 4*(symbols))
+
+/**
+ * @brief State of splitting of stream
+ */
+typedef struct hsplit {
+	uint32_t count; /**< count of segments counted already */
+	uint32_t len[HSPLIT_SEGMENTS + 1]; /**< size of every segment */
+	uint32_t hist[HSPLIT_SEGMENTS + 1][DICTSIZE]; /**< histogram of every segment */
+} hsplit_t;
+
+/**
+ * @brief Prepare splitting of new stream
+ *
+ * @param split State of splitting
+ */
+void hsplit_init( hsplit_t *split);
+
+/**
+ * @brief Find size of the first block of data
+ *
+ * Data should start at the split point returned by the previous call.
+ *
+ * @param split State of splitting
+ * @param data Raw data, up to hblock_size bytes
+ * @param size Size of data
+ *
+ * @return Size of the first block, equal to size if data should not be split
+ */
+uint32_t hsplit_find( hsplit_t *split, const uint8_t *data, uint32_t size);
+
+#endif /* HSPLIT_H */
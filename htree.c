@@ -10,384 +10,290 @@
 
 #include <huffman.h>
 #include <htree.h>
-#include <pqueue.h>
+
+/** Compare sort keys of symbols */
+static int htree_key_cmp( const void *first, const void *second) {
+
+	uint64_t k1 = *(const uint64_t *) first;
+	uint64_t k2 = *(const uint64_t *) second;
+
+	return (k1 > k2) - (k1 < k2);
+}
 
 /**
- * @brief Create node structure
+ * @brief Calculate optimal code lengths
  *
- * Should call hnode_destroy() or free memory by hands.
+ * Symbols are sorted by frequency once, then lengths are calculated
+ * in place in the sorted array (Moffat-Katajainen algorithm).
+ * No tree is created and no memory is allocated.
  *
- * @param frequency The frequency of code  
- * @param code Symbol code
+ * The array of weights is reused three times: for weights of internal
+ * nodes, then for indexes of parents, then for depths.
  *
- * @returns Pointer to created structure on success, NULL on error. 
- * 
-*/
-hnode_t *hnode_create( uint32_t frequency, uint8_t code) {
-	hnode_t *node;
-	
-	node = (hnode_t *) malloc( sizeof(hnode_t));
-
-	if (node == NULL)
-	   return NULL;	
-
-	node->freq = frequency;
-	node->code = code;
-	node->bits = 0;
-	node->blen = 0;
-	node->up = NULL;
-	node->left = NULL;
-	node->right = NULL;
-
-	return node;
-}
-
-/**
- * @brief Destroy node structure
+ * @param freq Frequency of every symbol, 0 for absent symbols
+ * @param[out] lengths Length of code for every symbol
+ * @param table_size Count of symbols, not more than 256
  *
- * @param Pointer to structure
+ * @returns Calculated size of compressed data in bits
  *
- * @returns Zero on success, non-zero if problem occured. 
 */
-int hnode_destroy( hnode_t * node) {
+uint64_t htree_code_lengths(const uint32_t *freq, uint8_t *lengths, uint32_t table_size) {
 
-	if (node == NULL)
-	   return 0;	
-
-	free(node);
-
-	return 0;	
-}
+	uint64_t key[256]; /* frequency and symbol, sorted */
+	uint32_t a[256];
+	int n = 0;
+	uint64_t coded_size = 0;
 
-#if 0
-/* TODO: version without priority queues */
-hnode_t *htree_add_node( hnode_t *head, hnode_t *node) {
+	assert( freq != NULL);
+	assert( lengths != NULL);
+	assert( table_size <= 256);
 
-	if (node == NULL)
-		return head;
+	for (uint32_t i=0; i<table_size; i++) {
+		lengths[i] = 0;
 
-	printf("     Adding %d = %d\n", node->code, node->freq);
-
-	node->up = NULL;
-	node->left = NULL;
-	node->right = NULL;
-	node->type = LEAF;
-
-
-	if (head == NULL) {
-		head = hnode_create( 0, 0);
-		assert( head != NULL);
-		head->type = NODE;
-		head->freq = node->freq;
-		head->left = node;
+		if (freq[i] != 0)
+			key[n++] = ((uint64_t) freq[i] << 8) | i;
+	}
 
-		node->up = head;
+	if (n == 0)
+		return 0;
 
-		return head;
+	if (n == 1) {
+		/* The only symbol still needs 1 bit */
+		lengths[key[0] & 0xFF] = 1;
+		return key[0] >> 8;
 	}
 
-	while (1) {
+	/* Ties are broken by symbol value, so result is reproducible */
+	qsort( key, n, sizeof(uint64_t), htree_key_cmp);
 
-		if (head->type == NODE){
-			/* NODE type */
-			printf("         node %d = %d\n", head->code, head->freq);
-			head->freq += node->freq;
+	for (int i=0; i<n; i++)
+		a[i] = (uint32_t) (key[i] >> 8);
 
-			if (head->left == NULL) {
-				printf("			adding to left  node %d = %d\n", head->code, head->freq);
-				head->left = node;
-				node->up = head;
-				break;
-			}
-	
-			if (head->right == NULL) {
-				printf("			adding to right node %d = %d\n", head->code, head->freq);
-				head->right = node;
-				node->up = head;
-				break;
-			}
-
-/*  			if ( head->->freq > head->freq) {
-				head = head->left;
-				printf("			going left to node %d = %d\n", head->code, head->freq);
-			} else {
-*/
-				head = head->right;
-				printf("			going right to node %d = %d\n", head->code, head->freq);
-//			}
+	/* Weights of internal nodes, leaves and nodes are merged as two sorted queues */
+	int root = 0, leaf = 2, next;
 
+	a[0] += a[1];
+	for (next=1; next < n-1; next++) {
+		if ((leaf >= n) || (a[root] < a[leaf])) {
+			a[next] = a[root];
+			a[root++] = next;
 		} else {
-			printf("         current %d = %d\n", head->code, head->freq);
-			static hnode_t *new_node; 	
-			/* Insert new_node empty node */
-			new_node = hnode_create( 0, 0);
-			assert( new_node != NULL);
-
-			new_node->up = head->up;
-			new_node->type = NODE;
-			new_node->freq = head->freq;
-			new_node->left = head;
-
-			if ( head->up != NULL) {
-				if (head->up->left == head) {
-					head->up->left = new_node;
-				} else {
-					head->up->right = new_node;
-				}
-			}
-
-			head->up = new_node;
+			a[next] = a[leaf++];
+		}
 
-			printf("         leaf up       %d = %d\n", head->up->code, head->up->freq);
-//			printf("         leaf up left  %d = %d\n", head->up->left->code, head->up->left->freq);
-//			printf("         leaf up right %d = %d\n", head->up->right->code, head->up->right->freq);
+		if ((leaf >= n) || ((root < next) && (a[root] < a[leaf]))) {
+			a[next] += a[root];
+			a[root++] = next;
+		} else {
+			a[next] += a[leaf++];
+		}
+	}
 
+	/* Depths of internal nodes */
+	a[n-2] = 0;
+	for (next=n-3; next >= 0; next--)
+		a[next] = a[a[next]] + 1;
+
+	/* Depths of leaves, the least frequent are the deepest */
+	int avail = 1, used = 0;
+	uint32_t depth = 0;
+
+	root = n-2;
+	next = n-1;
+	while (avail > 0) {
+		while ((root >= 0) && (a[root] == depth)) {
+			used++;
+			root--;
+		}
 
-			head = new_node;
+		while (avail > used) {
+			a[next--] = depth;
+			avail--;
 		}
-	} // while NODE	
 
-	printf("	HEAD now:  %d = %d\n", head->code, head->freq);
-	while (head->up != NULL)
-		head = head->up;
+		avail = 2 * used;
+		depth++;
+		used = 0;
+	}
+
+	for (int i=0; i<n; i++) {
+		lengths[key[i] & 0xFF] = (uint8_t) a[i];
+		coded_size += (key[i] >> 8) * a[i];
+	}
 
-	return head;
+	return coded_size;
 }
-#endif
 
 /**
- * @brief add node to head
+ * @brief Calculate optimal code lengths limited by maximal length
+ *
+ * Package-merge algorithm. Works on arrays on stack, no tree
+ * is created.
  *
- * Version for working with prioritized queues
- * expected to work with only 1-level!!!
+ * List of level L consists of leaves sorted by frequency, list of
+ * every upper level is merge of leaves with packages (pairs) of
+ * items from lower level. Code length of leaf is count of levels
+ * where it is among items selected for the code.
  *
- * @param head High-level node, NULL means a new high-level node will be created
- * @param node Low-level node to be added to High-level
+ * @param freq Frequency of every symbol, 0 for absent symbols
+ * @param[out] lengths Length of code for every symbol
+ * @param table_size Count of symbols, not more than 256
+ * @param maxlen Maximal length of code, not more than 32
+ *
+ * @returns Calculated size of compressed data in bits or 0 if symbols
+ *          could not be coded with such limit
  *
- * @returns High-level node 
 */
-hnode_t *htree_add_node( hnode_t *head, hnode_t *node) {
+uint64_t htree_limited_lengths(const uint32_t *freq, uint8_t *lengths, uint32_t table_size, uint32_t maxlen) {
 
-	if (node == NULL)
-		return head;
+	uint16_t leaf[256]; /* symbols sorted by frequency */
+	uint64_t weight[2][512]; /* weights of items in lists of current and lower levels */
+	uint8_t  package[32][512]; /* item of list is a package, not a leaf */
+	uint32_t size[32]; /* count of items in list of level */
+	uint32_t n = 0;
+	uint64_t coded_size = 0;
 
-//	DBGPRINT("Adding %d = %d\n", node->code, node->freq);
+	assert( freq != NULL);
+	assert( lengths != NULL);
+	assert( table_size <= 256);
+	assert( (maxlen > 0) && (maxlen <= 32));
 
-	node->up = NULL;
-//	node->left = NULL;
-//	node->right = NULL;
+	/* Insertion sort is good enough for 256 symbols */
+	for (uint32_t i=0; i<table_size; i++) {
+		lengths[i] = 0;
 
+		if (freq[i] == 0)
+			continue;
 
-	if (head == NULL) {
-		head = hnode_create( 0, 0);
-		assert( head != NULL);
+		uint32_t j = n++;
+		while ((j > 0) && (freq[leaf[j-1]] > freq[i])) {
+			leaf[j] = leaf[j-1];
+			j--;
+		}
+		leaf[j] = i;
 	}
 
+	if (n == 0)
+		return 0;
 
-	if (head->right == NULL) {
-//		DBGPRINT("adding to right node %d = %d\n", head->code, head->freq);
-		head->right = node;
-	} else if (head->left == NULL) {
-//		DBGPRINT("adding to left  node %d = %d\n", head->code, head->freq);
-		head->left = node;
-	} else {
-		/* Something goes wrong. WTF??? */
-		DBGPRINT("WRONG\n");
-		assert(0);
+	if (n == 1) {
+		lengths[leaf[0]] = 1;
+		return freq[leaf[0]];
 	}
 
-	head->freq += node->freq;
-
-	node->up = head;
-	return head;
-}
-
-
-static int hnode_cmp( const void *first, const void *second) {
-
-	static hnode_t ** s1, **s2;
-
-	s1 = (hnode_t **)first;
-	s2 = (hnode_t **)second;
-
-	if ( *s1 == *s2)
+	if ((maxlen < 32) && (n > (1U << maxlen)))
 		return 0;
-	if ( *s1 == NULL)
-		return 1;
-	if ( *s2 == NULL)
-		return -1;
-
-	return  ((*s2)->freq - (*s1)->freq);
-}
-
-int htree_buffer_sort( hnode_t **table, uint32_t table_size) {
-
-	qsort( table, (size_t) table_size, sizeof(hnode_t*), hnode_cmp);
-	return 0;
-}
 
+	/* The lowest level contains leaves only */
+	uint64_t *lower = weight[0];
+	uint64_t *current = weight[1];
 
-/*  */
-hnode_t *htree_create( hnode_t **table, uint32_t table_size) {
-
-	hnode_t *head=NULL;
-	pqnode_t *pqhead=NULL;
-
-	assert( table != NULL);
-	assert( table_size != 0);
-
-#if 0
-	/* TODO: used sorting before adding just for fun */
-	/* drop empty entries from initial set */
-	for (int i=0; i<table_size; i++) {
-		if ( table[i] == NULL) {
-			do {
-				table_size--;
-				if (table[table_size] != NULL)
-					break;
-			} while (table_size>i);
-			table[i]=table[table_size];
-			table[table_size] = NULL;
-		}
+	for (uint32_t i=0; i<n; i++) {
+		lower[i] = freq[leaf[i]];
+		package[maxlen-1][i] = 0;
 	}
+	size[maxlen-1] = n;
 
+	for (int level = maxlen-2; level >= 0; level--) {
+		uint32_t packages = size[level+1] / 2;
+		uint32_t l = 0, p = 0, k = 0;
 
-	htree_buffer_sort( table, table_size);
-#endif
+		/* Merge leaves with packages of lower level */
+		while ((l < n) || (p < packages)) {
+			uint64_t pweight = (p < packages) ? lower[2*p] + lower[2*p+1] : 0;
 
-//	DBGPRINT("PQueue creation start with %d table\n", table_size);
-	/* Create prioritized queue */
-	for (int i=0; i<table_size; i++) {
-	
-		if (table[i] == NULL){
-			continue;
+			if ((p >= packages) || ((l < n) && (freq[leaf[l]] <= pweight))) {
+				current[k] = freq[leaf[l++]];
+				package[level][k] = 0;
+			} else {
+				current[k] = pweight;
+				package[level][k] = 1;
+				p++;
+			}
+			k++;
 		}
+		size[level] = k;
 
-		pqnode_t *pqnode = pqueue_create_node(table[i]);
-		assert(pqnode != NULL);
-
-		pqhead = pqueue_add_node( pqhead, pqnode);
-		assert(pqhead != NULL);
-	
+		uint64_t *tmp = lower;
+		lower = current;
+		current = tmp;
 	}
 
-#ifdef DEBUG
-//	DBGPRINT("PQueue creation finished\n");
-//	pqueue_print(pqhead);
-#endif
-
-	while (1) {
-//	pqueue_print(pqhead);
-		hnode_t *hnode_new;
-		pqnode_t *pqnode_new;;
-		
-		/* Pop the 1-st */
-		hnode_new = htree_add_node( NULL, pqhead->hnode);
-		assert( hnode_new != NULL);
-
-		head = hnode_new;
-
-		pqhead = pqueue_del_node( pqhead, 0);
-		if (pqhead == NULL)
-			break;
-
-
-		/* Pop the 2-nd */
-		hnode_new = htree_add_node( hnode_new, pqhead->hnode);
-		assert( hnode_new != NULL);
-
-		pqhead = pqueue_del_node( pqhead, 0);
-		if (pqhead == NULL)
-			break;
-
-		pqnode_new = pqueue_create_node( hnode_new);
-		assert(pqnode_new != NULL);
-		
-		pqhead = pqueue_add_node( pqhead, pqnode_new);
-	}
+	/* Select 2n-2 items from the top level and walk down */
+	uint32_t selected = 2*n - 2;
 
-	return head;
-}
+	for (uint32_t level=0; level<maxlen; level++) {
+		uint32_t leaves = 0, packages = 0;
 
-void htree_destroy(hnode_t *node) {
+		for (uint32_t k=0; k<selected; k++) {
+			if (package[level][k])
+				packages++;
+			else
+				leaves++;
+		}
 
-	if (node == NULL)
-		return;
+		/* Leaves are merged in sorted order, so the first ones are selected */
+		for (uint32_t i=0; i<leaves; i++)
+			lengths[leaf[i]]++;
 
-	if (node->left != NULL) {
-		htree_destroy(node->left);
+		selected = 2 * packages;
 	}
 
-	if (node->right != NULL) {
-		htree_destroy(node->right);
-	}
+	for (uint32_t i=0; i<n; i++)
+		coded_size += (uint64_t) freq[leaf[i]] * lengths[leaf[i]];
 
-	hnode_destroy(node);
+	return coded_size;
 }
 
 /**
- * @brief Calculate bits 
+ * @brief Assign canonical codes
  *
- * Recursive walk through huffman tree and calculate 
- * codes for corresponding leaf 
+ * Codes are assigned in order of length and symbol value,
+ * so only lengths are needed to restore them.
  *
- * @param head Pointer to huffman tree head
- * @param level Current depth 
- * @param hcode Huffman code from previous level
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param[out] codes Canonical code (MSB-first) for every symbol
+ * @param table_size Count of symbols
+ *
+ * @returns zero on success, -1 if lengths can't form prefix code
  *
- * @returns Calculated size of compressed data in bits
- * 
 */
-uint32_t htree_add_codes(hnode_t *node, int level, uint32_t hcode) {
+int htree_canonical_codes(const uint8_t *lengths, uint32_t *codes, uint32_t table_size) {
 
-	uint32_t coded_size = 0;
+	uint32_t count[256]; /* count of codes of every length */
+	uint64_t next[256]; /* next code of every length */
+	uint64_t code = 0;
 
-	if (node == NULL)
-		return 0;
+	assert( lengths != NULL);
+	assert( codes != NULL);
 
-	node->bits = hcode;
-	node->blen = level;
+	memset( count, 0, sizeof(count));
 
-	if ((node->left == NULL) && (node->right == NULL)) {
-		coded_size += node->freq * level;
-		return coded_size;
-	}
+	for (uint32_t i=0; i<table_size; i++)
+		count[lengths[i]]++;
 
-	hcode <<= 1;
-	level++;
+	/* The first code of length is right after the last code of shorter length */
+	count[0] = 0;
+	for (uint32_t len=1; len<256; len++) {
+		code = (code + count[len-1]) << 1;
+		next[len] = code;
 
-	if (node->left != NULL) {
-		coded_size += htree_add_codes(node->left, level, hcode);
+		/* Codes of this length should fit into it */
+		if ((len <= 32) && (code + count[len] > ((uint64_t) 1 << len)))
+			return -1;
+		if ((len > 32) && (count[len] != 0))
+			return -1;
 	}
 
-	if (node->right != NULL) {
-		hcode |= 1;
-		coded_size += htree_add_codes(node->right, level, hcode);
-	}
-
-	return coded_size;
-}
-
-
-void htree_print(const hnode_t *node, int level) {
-
-	if (node == NULL)
-		return;
+	for (uint32_t i=0; i<table_size; i++) {
+		if (lengths[i] == 0) {
+			codes[i] = 0;
+			continue;
+		}
 
-	if ((node->left == NULL) && (node->right == NULL)) {
-		printf("%d: Leaf with code=%.3d, frequency=%u, encoded 0x%.4X (%d)\n", level,
-			   	node->code, node->freq, node->bits, node->blen);
-	} else {
-		printf("%d: Node with weight=%u\n", level, node->freq);
+		codes[i] = (uint32_t) next[lengths[i]]++;
 	}
 
-	level++;
-
-	if (node->left != NULL)
-		htree_print(node->left, level);
-
-	if (node->right != NULL)
-		htree_print(node->right, level);
-
+	return 0;
 }
-
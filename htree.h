@@ -14,87 +14,51 @@
 #include <assert.h>
 
 /**
- * @brief Huffman tree node description
-*/
-struct hnode {
-	uint32_t freq; /**< frequency -- how often symbol appered in buffer */
-	uint8_t  code; /**< code of symbol */
-	uint32_t bits; /**< binary representation */
-	uint32_t blen; /**< count of bits in  binary representation */
-	struct hnode *up; /**< pointer to upper level */
-	struct hnode *left; /**< pointer to left child */
-	struct hnode *right; /**< pointer to right child */
-};
-
-typedef struct hnode hnode_t;
-
-/**
- * @brief Create node structure
+ * @brief Calculate optimal code lengths
  *
- * Should call hnode_destroy() or free memory by hands.
- *
- * @param frequency The frequency of code  
- * @param code Symbol code
- *
- * @returns Pointer to created structure on success, NULL on error. 
- * 
-*/
-hnode_t *hnode_create( uint32_t frequency, uint8_t code);
-
-/** 
- * @brief Create huffman tree 
+ * Symbols are sorted by frequency once, then lengths are calculated
+ * in place in the sorted array (Moffat-Katajainen algorithm).
+ * No tree is created and no memory is allocated.
  *
- * Create huffman tree from array with collected statistics.
- * htree_destroy() should be called to free associated resources. 
+ * @param freq Frequency of every symbol, 0 for absent symbols
+ * @param[out] lengths Length of code for every symbol
+ * @param table_size Count of symbols, not more than 256
  *
- * @param[in] table -- pointer to collected statistics
- * @param[in] table_size -- size of table
+ * @returns Calculated size of compressed data in bits
  *
- * @returns pointer to tree header
 */
-hnode_t *htree_create(hnode_t **table, uint32_t table_size);
+uint64_t htree_code_lengths(const uint32_t *freq, uint8_t *lengths, uint32_t table_size);
 
 /**
- * @brief Destroy huffman tree
+ * @brief Calculate optimal code lengths limited by maximal length
  *
- * Destroy huffman tree starting with head.
- * Release all resources associated with this tree.
+ * Package-merge algorithm. Works on arrays on stack, no tree
+ * is created.
  *
- * @param head Pointer to huffman tree head
+ * @param freq Frequency of every symbol, 0 for absent symbols
+ * @param[out] lengths Length of code for every symbol
+ * @param table_size Count of symbols, not more than 256
+ * @param maxlen Maximal length of code, not more than 32
  *
- * @returns Nothing
- * 
-*/
-void htree_destroy(hnode_t *head);
-
-/**
- * @brief Calculate bits 
- *
- * Recursive walk through huffman tree and calculate 
- * codes for corresponding leaf 
+ * @returns Calculated size of compressed data in bits or 0 if symbols
+ *          could not be coded with such limit
  *
- * @param head Pointer to huffman tree head
- * @param level Current depth 
- * @param hcode Huffman code from previous level
- *
- * @returns Calculated size of compressed data
- * 
 */
-uint32_t htree_add_codes(hnode_t *head, int level, uint32_t hcode);
-
+uint64_t htree_limited_lengths(const uint32_t *freq, uint8_t *lengths, uint32_t table_size, uint32_t maxlen);
 
 /**
- * @brief Print huffman tree
+ * @brief Assign canonical codes
  *
- * Recursive walk through huffman tree
+ * Codes are assigned in order of length and symbol value,
+ * so only lengths are needed to restore them.
  *
- * @param head Pointer to huffman tree head
- * @param level Current depth 
+ * @param lengths Length of code for every symbol, 0 for absent symbols
+ * @param[out] codes Canonical code (MSB-first) for every symbol
+ * @param table_size Count of symbols
+ *
+ * @returns zero on success, -1 if lengths can't form prefix code
  *
- * @returns Nothing
- * 
 */
-void htree_print(const hnode_t *head, int level);
+int htree_canonical_codes(const uint8_t *lengths, uint32_t *codes, uint32_t table_size);
 
 #endif /* HTREE_H */
-
@@ -9,6 +9,13 @@
 #include <huffman.h>
 #include <parse_args.h>
 #include <hblock.h>
+#include <hpool.h>
+#include <hmap.h>
+#include <hio.h>
+#include <hindex.h>
+#include <hsplit.h>
+#include <hchain.h>
+#include <hcpu.h>
 
 #include <time.h>
 
@@ -16,27 +23,305 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-int main( int argc, char **argv) {
+/** Data after the split point of the last block read from stream, NULL if none */
+static hblock_t *raw_rest = NULL;
 
-	uint8_t *buffer;
+/** Block read from ring but not taken yet, it tops up raw_rest */
+static hblock_t *raw_ahead = NULL;
 
-	appmode_t mode;
+/** State of adaptive splitting of input */
+static hsplit_t raw_splitter;
 
-	parse_args( argc, argv, &mode);
-#ifdef DEBUG
-	if (mode == COMPRESSOR) {
-		DBGPRINT("Starting compressor ... \n");
-	} else if (mode == DECOMPRESSOR) {
-		DBGPRINT("Starting decompressor ... \n");
+/** Number of the next block read from input */
+static uint32_t raw_seq = 0;
+
+/** Table of the previous block of stream */
+static hchain_t stream_chain;
+
+/**
+ * @brief Cut block read from stream at the split point
+ *
+ * Data after the split point is copied to the new block kept in
+ * raw_rest, it is the beginning of the next block.
+ *
+ * @param block Block with raw data
+ */
+static void raw_split( hblock_t *block) {
+
+	uint32_t size = hsplit_find( &raw_splitter, block->raw, block->raw_size);
+
+	if (size == block->raw_size)
+		return;
+
+	uint8_t *buffer = hpool_get( hblock_raw_pool);
+	assert( buffer != NULL);
+
+	memcpy( buffer, block->raw + size, block->raw_size - size);
+
+	raw_rest = hblock_adopt( buffer, block->raw_size - size, RAW_READY, hblock_raw_pool);
+	assert( raw_rest != NULL);
+
+	block->raw_size = size;
+}
+
+/**
+ * @brief Top up block with the next data of stream
+ *
+ * @param block Block with the beginning of data
+ * @param io Ring for reading input, NULL for synchronous reading
+ */
+static void raw_fill( hblock_t *block, hio_t *io) {
+
+	if (io == NULL) {
+		block->raw_size += rawreader( fd_input, block->raw + block->raw_size,
+				hblock_size - block->raw_size);
+		return;
 	}
-#endif
-	buffer = malloc( BUFFERSIZE);
+
+	/* Ring reads whole blocks, data is taken from the beginning of the next one */
+	while (block->raw_size < hblock_size) {
+		if ((raw_ahead == NULL) && ((raw_ahead = hio_read_block( io)) == NULL))
+			return;
+
+		uint32_t len = hblock_size - block->raw_size;
+		if (len > raw_ahead->raw_size)
+			len = raw_ahead->raw_size;
+
+		memcpy( block->raw + block->raw_size, raw_ahead->raw, len);
+		block->raw_size += len;
+		raw_ahead->raw += len;
+		raw_ahead->raw_size -= len;
+
+		if (raw_ahead->raw_size == 0) {
+			hblock_destroy( raw_ahead);
+			raw_ahead = NULL;
+		}
+	}
+}
+
+/**
+ * @brief Get the next block of input
+ *
+ * Mapped input is not copied, block refers to the mapping.
+ * Otherwise data is read to buffer from pool. Blocks are split
+ * by content if hsplit_enabled is set.
+ *
+ * @param map Mapping of input, map->data is NULL if input is not mapped
+ * @param[in,out] offset Position of the next block in mapping
+ * @param io Ring for reading input, NULL for synchronous reading
+ *
+ * @return Block with raw data or NULL at the end of input
+ */
+static hblock_t *raw_next( hmap_t *map, size_t *offset, hio_t *io) {
+
+	hblock_t *block;
+
+	if (map->data != NULL) {
+		if (*offset >= map->size)
+			return NULL;
+
+		size_t size = map->size - *offset;
+		if (size > hblock_size)
+			size = hblock_size;
+
+		if (hsplit_enabled)
+			size = hsplit_find( &raw_splitter, map->data + *offset, size);
+
+		block = hblock_view( map->data + *offset, size, RAW_READY);
+		*offset += size;
+	} else if (raw_rest != NULL) {
+		block = raw_rest;
+		raw_rest = NULL;
+
+		raw_fill( block, io);
+	} else if (raw_ahead != NULL) {
+		/* The rest of block partially taken by the previous one */
+		block = raw_ahead;
+		raw_ahead = NULL;
+
+		memmove( block->rbuffer, block->raw, block->raw_size);
+		block->raw = block->rbuffer;
+
+		raw_fill( block, io);
+	} else if (io != NULL) {
+		block = hio_read_block( io);
+		if (block == NULL)
+			return NULL;
+	} else {
+		/* Read data from stream directly to buffer of block */
+		uint8_t *buffer = hpool_get( hblock_raw_pool);
+		assert( buffer != NULL);
+
+		uint32_t readed = rawreader (fd_input, buffer, hblock_size);
+
+		DBGPRINT("Read block of %d size\n", readed);
+
+		if (readed <= 0) {
+			hpool_put( hblock_raw_pool, buffer);
+			return NULL;
+		}
+
+		block = hblock_adopt( buffer, readed, RAW_READY, hblock_raw_pool);
+	}
+
+	assert (block != NULL);
+
+	if (hsplit_enabled && (map->data == NULL))
+		raw_split( block);
+
+	/* Blocks take their turns in chain in order of input */
+	block->seq = raw_seq++;
+
+	return block;
+}
+
+/**
+ * @brief Write compressed block and destroy it
+ *
+ * Stops if block could not be compressed, frames before
+ * it are written out.
+ *
+ * @param io Ring for writing output, NULL for synchronous writing
+ * @param index Index of blocks or NULL
+ * @param block Compressed block
+ */
+static void frame_write( hio_t *io, hindex_t *index, hblock_t *block) {
+
+	uint32_t raw_size = block->raw_size;
+	int own_table = (block->type == HPB_TYPE_HUFFMAN) && !block->reuse_table;
+	size_t len;
+
+	if (hblock_get_state( block) == ERROR) {
+		if (io != NULL)
+			hio_destroy( io);
+
+		fprintf( stderr, "Failed to compress block\n");
+		exit( 1);
+	}
+
+	if (io != NULL) {
+		len = hio_write_block( io, block);
+	} else {
+		len = streamwriter( fd_output, block);
+		hblock_destroy( block);
+	}
+
+	if ((index != NULL) && (hindex_add( index, len, raw_size, own_table) != 0)) {
+		fprintf( stderr, "Out of memory\n");
+		exit( 1);
+	}
+}
+
+/**
+ * @brief Write decompressed block and destroy it
+ *
+ * @param io Ring for writing output, NULL for synchronous writing
+ * @param block Decompressed block
+ */
+static void raw_write( hio_t *io, hblock_t *block) {
+
+	if (io != NULL) {
+		hio_write_block( io, block);
+		return;
+	}
+
+	rawwriter( fd_output, block);
+
+	hblock_destroy( block);
+}
+
+/**
+ * @brief Stop on corrupted input
+ *
+ * Data decompressed before the corrupted block is written out.
+ *
+ * @param io Ring for writing output or NULL
+ */
+static void corrupted( hio_t *io) {
+
+	if (io != NULL)
+		hio_destroy( io);
+
+	fprintf( stderr, "Corrupted block in input stream\n");
+	exit( 1);
+}
+
+/**
+ * @brief Decompress range of raw data using index of blocks
+ *
+ * @param offset Position of range in raw data
+ * @param size Size of range
+ */
+static void decompress_range( uint64_t offset, uint64_t size) {
+
+	hindex_t index;
+	hchain_t chain;
+	hdctx_t ctx;
+
+	if (hindex_read( fd_input, &index) != 0) {
+		fprintf( stderr, "Input has no index of blocks\n");
+		exit( 1);
+	}
+
+	if (hdctx_init( &ctx) != 0) {
+		fprintf( stderr, "Out of memory\n");
+		exit( 1);
+	}
+
+	uint8_t *buffer = hpool_get( hblock_raw_pool);
 	assert( buffer != NULL);
 
-	#ifdef _OPENMP
+	/* Table of the first block is read back once, the next ones follow it */
+	hchain_init( &chain);
+
+	uint64_t end = index.raw_offsets[index.count];
+	if (offset > end)
+		offset = end;
+	if (size < end - offset)
+		end = offset + size;
+
+	while (offset < end) {
+		/* Every block is decoded once */
+		uint32_t i = hindex_find( &index, offset);
+		uint64_t len = ((end < index.raw_offsets[i + 1]) ? end : index.raw_offsets[i + 1]) - offset;
+
+		if (len > hblock_size)
+			len = hblock_size;
+
+		int64_t rc = hindex_pread( fd_input, &index, buffer, len, offset, &chain, &ctx);
+		if (rc <= 0) {
+			fprintf( stderr, "Corrupted block in input stream\n");
+			exit( 1);
+		}
+
+		for (int64_t done = 0; done < rc; ) {
+			ssize_t wr = write( fd_output, buffer + done, rc - done);
+			if (wr <= 0) {
+				perror("write failed");
+				exit( 1);
+			}
+			done += wr;
+		}
+
+		offset += rc;
+	}
+
+	hpool_put( hblock_raw_pool, buffer);
+	hdctx_destroy( &ctx);
+	hindex_free( &index);
+}
+
+#ifdef _OPENMP
+#include <fqueue.h>
+
+/**
+ * @brief Set count of threads for pipeline
+ *
+ * @return Count of threads: reader, writer and a worker for every CPU
+ */
+static int pipeline_threads( void) {
 
 	int np=1;
-	int myid=0;
 
 	#pragma omp parallel
 	np = omp_get_num_threads();
@@ -46,7 +331,33 @@ int main( int argc, char **argv) {
 	omp_set_dynamic(0);
 	omp_set_num_threads( np);
 
-	#pragma omp parallel private (np, myid)
+	return np;
+}
+
+/**
+ * @brief Parallel compression of input stream
+ *
+ * Thread 0 reads raw blocks and puts them to the queue,
+ * thread 1 writes compressed blocks in original order and
+ * all other threads compress blocks. Output is the same as
+ * for serial version.
+ *
+ * @param map Mapping of input, map->data is NULL if input is not mapped
+ * @param in Ring for reading input or NULL
+ * @param out Ring for writing output or NULL
+ * @param index Index of blocks or NULL
+ */
+static void compress_parallel( hmap_t *map, hio_t *in, hio_t *out, hindex_t *index) {
+
+	int np = pipeline_threads();
+	int myid=0;
+	size_t offset = 0;
+
+	/* Enough blocks in flight to keep all workers busy */
+	fqhdr_t *fq = fqueue_create( np * 2);
+	assert( fq != NULL);
+
+	#pragma omp parallel private (np, myid) shared (fq, offset)
 	{
 		np = omp_get_num_threads();
 		myid = omp_get_thread_num();
@@ -58,72 +369,291 @@ int main( int argc, char **argv) {
 		switch (myid) {
 			case 0: /* stream reader */
 				DBGPRINT( "My thread is %d and I am reader\n", myid);
+				while (1) {
+					hblock_t *block = raw_next( map, &offset, in);
+					if (block == NULL)
+						break;
+
+					fqueue_wait_push( fq, block);
+				}
+
+				fqueue_close( fq);
 				break;
 			case 1: /* stream writer */
 				DBGPRINT( "My thread is %d and I am writer\n", myid);
+				while (1) {
+					hblock_t *block = fqueue_wait_pop( fq);
+					if (block == NULL)
+						break;
+
+					frame_write( out, index, block);
+				}
 				break;
 			default: /* worker */
 				DBGPRINT( "My thread is %d and I am worker\n", myid);
+				while (1) {
+					hblock_t *block = fqueue_wait_node( fq, RAW_READY);
+					if (block == NULL)
+						break;
+
+					hblock_compress( block, &stream_chain);
+
+					fqueue_release_node( fq, block);
+				}
 				break;
 
 		}
 	}
-	#else
 
-	switch (mode) {
-	
-		case COMPRESSOR: /* Compress input stream */
-			while (1) {
+	fqueue_destroy( fq);
+}
 
-				/* Read data from stream */
-				uint32_t readed = rawreader (fd_input, buffer, BUFFERSIZE);
+/**
+ * @brief Parallel decompression of input stream
+ *
+ * Thread 0 splits input to frames and parses them, frames could
+ * refer to table of the previous frame, so they are parsed in
+ * order. Thread 1 writes decompressed blocks in original order
+ * and all other threads decode frames.
+ *
+ * @param out Ring for writing output or NULL
+ */
+static void decompress_parallel( hio_t *out) {
+
+	int np = pipeline_threads();
+	int myid=0;
+	int broken = 0; /**< input is cut or frame is broken */
+	int failed = 0; /**< some frame can't be decoded */
 
-				DBGPRINT("Read block of %d size\n", readed);
+	/* Enough blocks in flight to keep all workers busy */
+	fqhdr_t *fq = fqueue_create( np * 2);
+	assert( fq != NULL);
 
-				if (readed <= 0)
-					break;
+	#pragma omp parallel private (np, myid) shared (fq, broken, failed)
+	{
+		np = omp_get_num_threads();
+		myid = omp_get_thread_num();
+		if (np<3) {
+			fprintf( stderr, "At least 3 threads needed. Please use non-parallel version instead.\n");
+			exit (1);
+		}
+
+		switch (myid) {
+			case 0: /* stream reader */
+				DBGPRINT( "My thread is %d and I am reader\n", myid);
+				while (1) {
+					hblock_t *block = framereader( fd_input);
+					if (block == NULL)
+						break;
+
+					/* Frames before the broken one are still written */
+					if (hblock_parse( block, &stream_chain) != 0) {
+						hblock_destroy( block);
+						broken = 1;
+						break;
+					}
+
+					fqueue_wait_push( fq, block);
+				}
+
+				fqueue_close( fq);
+				break;
+			case 1: /* stream writer */
+				DBGPRINT( "My thread is %d and I am writer\n", myid);
+				while (1) {
+					hblock_t *block = fqueue_wait_pop( fq);
+					if (block == NULL)
+						break;
+
+					if (hblock_get_state( block) == ERROR) {
+						/* Keep taking blocks, so reader and workers are not blocked */
+						failed = 1;
+						hblock_destroy( block);
+						continue;
+					}
+
+					if (!failed)
+						raw_write( out, block);
+					else
+						hblock_destroy( block);
+				}
+				break;
+			default: { /* worker */
+				hdctx_t ctx; /**< tables of the last block decoded by this thread */
+
+				DBGPRINT( "My thread is %d and I am worker\n", myid);
+				if (hdctx_init( &ctx) != 0) {
+					fprintf( stderr, "Out of memory\n");
+					exit( 1);
+				}
+
+				while (1) {
+					hblock_t *block = fqueue_wait_node( fq, ZDATA_READY);
+					if (block == NULL)
+						break;
+
+					/* Switches block to READY or ERROR */
+					hblock_decompress( block, &ctx);
+
+					fqueue_release_node( fq, block);
+				}
+
+				hdctx_destroy( &ctx);
+				break;
+			}
+
+		}
+	}
+
+	fqueue_destroy( fq);
 
-				#ifdef DEBUG
-				/* probably impossible ? */
-				assert (readed <= BUFFERSIZE);
-				#endif
+	if (broken || failed)
+		corrupted( out);
+}
+#endif
+
+int main( int argc, char **argv) {
+
+	appmode_t mode;
+	hmap_t map;
+	hio_t in, out;
+	hio_t *pin = NULL, *pout = NULL; /**< rings in use, NULL for synchronous I/O */
+	hindex_t index;
+	hindex_t *pindex = NULL;
+#ifndef _OPENMP
+	size_t offset = 0;
+	hdctx_t ctx; /**< decoder tables reused by blocks */
+#endif
+
+	parse_args( argc, argv, &mode);
+	hcpu_init();
+#ifdef DEBUG
+	if (mode == COMPRESSOR) {
+		DBGPRINT("Starting compressor ... \n");
+	} else if (mode == DECOMPRESSOR) {
+		DBGPRINT("Starting decompressor ... \n");
+	}
+#endif
+	/* Buffers of pools fit blocks of compressed stream, -b is a hint for pipes */
+	if (mode == DECOMPRESSOR) {
+		uint32_t size = hblock_stream_size( fd_input);
+
+		if ((size >= BLOCKSIZE_MIN) && (size <= BLOCKSIZE_MAX))
+			hblock_size = size;
+	}
+
+	/* Enough buffers for all blocks in flight: full queue, reader and writer */
+	uint32_t inflight = 2;
+#ifdef _OPENMP
+	inflight = (omp_get_max_threads() + 2) * 4 + 2;
+#endif
+	/* Blocks being read and written asynchronously */
+	if (hio_uring)
+		inflight += HIO_DEPTH * 2;
+	if (hblock_pools_create( inflight) != 0) {
+		fprintf( stderr, "Out of memory\n");
+		exit( 1);
+	}
+
+	memset( &map, 0, sizeof(map));
+	hsplit_init( &raw_splitter);
+	hchain_init( &stream_chain);
 
-				hblock_t *block = hblock_create( buffer, readed, RAW_READY);
-				assert (block != NULL);
+	/* Asynchronous writing, falls back to write() if io_uring is not available */
+	if (hio_uring && !range_enabled && (hio_create( &out, fd_output,
+			(mode == COMPRESSOR) ? HIO_WRITE_FRAMES : HIO_WRITE_RAW,
+			(mode == COMPRESSOR) ? NULL : hblock_raw_pool) == 0))
+		pout = &out;
+
+	switch (mode) {
+	
+		case COMPRESSOR: /* Compress input stream */
+			/* Regular files are mapped instead of reading */
+			if (hmap_open( fd_input, &map) != 0) {
+				DBGPRINT("Input is not mapped, reading it\n");
+
+				if (hio_uring && (hio_create( &in, fd_input, HIO_READ_RAW, hblock_raw_pool) == 0))
+					pin = &in;
+			}
+
+			if (hindex_enabled) {
+				if (hindex_init( &index) != 0) {
+					fprintf( stderr, "Out of memory\n");
+					exit( 1);
+				}
+				pindex = &index;
+			}
+#ifdef _OPENMP
+			compress_parallel( &map, pin, pout, pindex);
+#else
+			while (1) {
 
-				hblock_compress( block);
+				hblock_t *block = raw_next( &map, &offset, pin);
+				if (block == NULL)
+					break;
 
-				streamwriter( fd_output, block);
+				hblock_compress( block, &stream_chain);
 
-				hblock_destroy( block);
+				frame_write( pout, pindex, block);
 			};
+#endif // OMP
 			break;
 		
 		case DECOMPRESSOR: /* Compress input stream */
+			if (range_enabled) {
+				decompress_range( range_offset, range_size);
+				break;
+			}
+
+#ifdef _OPENMP
+			decompress_parallel( pout);
+#else
+			if (hdctx_init( &ctx) != 0) {
+				fprintf( stderr, "Out of memory\n");
+				exit( 1);
+			}
+
 			while (1) {
-				hblock_t *block = streamreader( fd_input);
+				hblock_t *block = streamreader( fd_input, &stream_chain);
 				if (block == NULL)
 					break;
 
-				hblock_decompress( block);
+				if (hblock_decompress( block, &ctx) != 0)
+					corrupted( pout);
 
-				rawwriter( fd_output, block);
-
-				hblock_destroy( block);
+				raw_write( pout, block);
 			};
+
+			hdctx_destroy( &ctx);
+#endif // OMP
 			break;
 
 		default:
 			break;
 	}
 
-	#endif // OMP
 
+	/* Wait for writes in flight, then blocks referring to mapping are destroyed */
+	if (pout != NULL)
+		hio_destroy( pout);
+	if (pin != NULL)
+		hio_destroy( pin);
+	hmap_close( &map);
+
+	/* Index follows all blocks */
+	if (pindex != NULL) {
+		if (hindex_write( fd_output, pindex) != 0) {
+			perror("Failed to write index");
+			exit( 1);
+		}
+		hindex_free( pindex);
+	}
 
 	close( fd_input);
 	close( fd_output);
 
-	free(buffer);
+	hblock_pools_destroy();
+
 	return 0;
 }
 
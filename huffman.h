@@ -22,9 +22,21 @@
 #endif
 
 #define DICTSIZE 256 /**< count of elements in dictionary */
-#define BUFFERSIZE 512*1024
-
-#define HPB_MESSAGE_MAX BUFFERSIZE*2 /**< to be sure we have enough space for read messages from stream */
+#define ZSTREAMS 4 /**< count of interleaved bit streams in multi-stream block */
+#define BUFFERSIZE 512*1024 /**< default size of block, the largest block of old versions */
+#define BLOCKSIZE_MIN (4*1024) /**< the smallest size of block */
+#define BLOCKSIZE_MAX (64*1024*1024) /**< the largest size of block */
+
+#define HPB_MESSAGE_MAX (BLOCKSIZE_MAX*2) /**< to be sure we have enough space for read messages from stream */
+#define HPB_HEADER_MAX 1024 /**< size of message with all fields except payload, enough for any code table */
+#define HPB_PAYLOAD_HEADER_MAX 6 /**< tag and length of payload field */
+#define HPB_FRAME_SIZE(block) ((block) + HPB_HEADER_MAX) /**< the largest message written for block of given size */
+#define HPB_TYPE_HUFFMAN 0 /**< payload is coded with Huffman code, default type of frame */
+#define HPB_TYPE_STORED 1 /**< payload is raw data, coding does not shrink it */
+#define HPB_TYPE_RUN 2 /**< raw data is raw_len copies of the only byte of payload */
+#define HPB_INDEX_FLAG 0x80000000 /**< set in size of frame with index of blocks */
+#define HPB_INDEX_MAGIC 0x485A4958 /**< "HZIX", the last bytes of stream with index */
+#define HPB_INDEX_TRAILER 8 /**< size of frame and magic after index */
 
 #ifdef DEBUG
 #define DBGPRINT(...) \
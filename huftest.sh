@@ -16,6 +16,8 @@ ZEROFILE=$PREFIX.zero
 UNBFILE=$PREFIX.unb
 # Just for fun -- empty file ;-)
 EMPTFILE=$PREFIX.empty
+# Pieces of the files above -- tables are reused between stored and run blocks
+MIXFILE=$PREFIX.mix
 
 if [ -z "$HUFFMAN" ] ; then
     echo "Usage: $0 <huffman_binary>"
@@ -33,6 +35,19 @@ echo "- generate unbalanced"
 [ -f "$UNBFILE" ] || ./gen_unbalanced_data 28 > "$UNBFILE"
 echo "- empty"
 [ -f "$EMPTFILE" ] || touch "$EMPTFILE"
+echo "- mixed"
+if [ ! -f "$MIXFILE" ] ; then
+    head -c 1M "$RANDFILE" | base64 -w 0 > "$MIXFILE".b64
+    for i in $(seq 0 255) ; do
+        case $((i % 8)) in
+            3) SRC="$ZEROFILE" ;;
+            6) SRC="$RANDFILE" ;;
+            *) SRC="$MIXFILE".b64 ;;
+        esac
+        dd if="$SRC" bs=4K skip=$i count=1 status=none
+    done > "$MIXFILE"
+    rm -f "$MIXFILE".b64
+fi
 
 
 echo Huffman test started.
@@ -40,9 +55,12 @@ echo Huffman test started.
 test() {
 
     local FILE="$1"
+    shift
+
+    rm -f "$FILE".compressed "$FILE".decompressed
 
-    echo -n "$FILE compressed in "
-    time -f "%U seconds (user time only)" "$HUFFMAN" -c "$FILE" "$FILE".compressed
+    echo -n "$FILE $* compressed in "
+    time -f "%U seconds (user time only)" "$HUFFMAN" -c "$@" "$FILE" "$FILE".compressed
     echo -n "$FILE decompressed in "
     time -f "%U seconds (user time only)" "$HUFFMAN" -x "$FILE".compressed "$FILE".decompressed
     cmp "$FILE" "$FILE".decompressed || echo "Decompressed file differs from original one!!!"
@@ -50,7 +68,85 @@ test() {
     rm -f "$FILE".compressed "$FILE".decompressed
 }
 
+# Decompress range of indexed file: FILE OFFSET SIZE [compress options]
+test_range() {
+
+    local FILE="$1"
+    local OFFSET="$2"
+    local SIZE="$3"
+    shift 3
+
+    rm -f "$FILE".compressed "$FILE".decompressed
+
+    echo "$FILE $* range $OFFSET:$SIZE"
+    "$HUFFMAN" -c -i "$@" "$FILE" "$FILE".compressed
+    "$HUFFMAN" -x -r "$OFFSET:$SIZE" "$FILE".compressed "$FILE".decompressed
+    tail -c +$((OFFSET + 1)) "$FILE" | head -c "$SIZE" | cmp - "$FILE".decompressed || echo "Decompressed range differs from original one!!!"
+
+    rm -f "$FILE".compressed "$FILE".decompressed
+}
+
 
-for INFILE in "$ZEROFILE" "$RANDFILE" "$UNBFILE" "$EMPTFILE" ; do
+for INFILE in "$ZEROFILE" "$RANDFILE" "$UNBFILE" "$EMPTFILE" "$MIXFILE" ; do
     test "$INFILE"
 done
+
+# Blocks of 4K reuse tables, stored and run blocks between them are counted too
+test "$MIXFILE" -b 4K
+
+# Asynchronous reading and writing with io_uring
+for INFILE in "$ZEROFILE" "$RANDFILE" "$MIXFILE" ; do
+    test "$INFILE" -u
+done
+test "$MIXFILE" -b 4K -u
+
+# Index of blocks, ranges start at the first block, cross blocks and run to the end of file
+for INFILE in "$ZEROFILE" "$RANDFILE" "$MIXFILE" ; do
+    test "$INFILE" -i
+    test_range "$INFILE" 0 4096
+    test_range "$INFILE" 524287 2
+    test_range "$INFILE" 1000000 1000000
+    test_range "$INFILE" 500000 100000000
+done
+
+# Size of block is set at runtime
+for OPTS in "-b 4K" "-b 64K" "-b 1M" ; do
+    for INFILE in "$ZEROFILE" "$RANDFILE" "$MIXFILE" ; do
+        test "$INFILE" $OPTS
+    done
+done
+test_range "$RANDFILE" 1000000 300000 -b 64K
+
+# Range is not accepted for compression
+if "$HUFFMAN" -c -r 0 "$MIXFILE" /dev/null 2> /dev/null ; then
+    echo "Range was accepted for compression!!!"
+fi
+
+# Adaptive split of blocks
+for INFILE in "$ZEROFILE" "$RANDFILE" "$UNBFILE" "$MIXFILE" ; do
+    test "$INFILE" -a
+done
+test "$MIXFILE" -a -u
+test_range "$MIXFILE" 100000 300000 -a
+
+# Single pass
+for INFILE in "$ZEROFILE" "$RANDFILE" "$UNBFILE" "$MIXFILE" ; do
+    test "$INFILE" -p
+done
+test "$MIXFILE" -b 4K -p
+
+# Ranges start inside chain of blocks reusing table, at run and stored blocks
+for OPTS in "" "-p" ; do
+    test_range "$MIXFILE" 20580 12288 -b 4K $OPTS
+    test_range "$MIXFILE" 12288 70000 -b 4K $OPTS
+    test_range "$MIXFILE" 24576 1 -b 4K $OPTS
+    test_range "$MIXFILE" 500000 1048576 -b 4K $OPTS
+done
+
+# Output file is truncated, index is found at the end of the new stream
+head -c 2M "$RANDFILE" > "$MIXFILE".compressed
+"$HUFFMAN" -c -i "$MIXFILE" "$MIXFILE".compressed
+rm -f "$MIXFILE".decompressed
+"$HUFFMAN" -x -r 1000:100000 "$MIXFILE".compressed "$MIXFILE".decompressed
+tail -c +1001 "$MIXFILE" | head -c 100000 | cmp - "$MIXFILE".decompressed || echo "Decompressed range differs from original one!!!"
+rm -f "$MIXFILE".compressed "$MIXFILE".decompressed
@@ -7,6 +7,13 @@
 */
 
 #include "parse_args.h"
+#include <hblock.h>
+#include <hencode.h>
+#include <hio.h>
+#include <hindex.h>
+#include <hsplit.h>
+#include <hchain.h>
+#include <hcpu.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -18,11 +25,29 @@ extern int optind,  opterr,  optopt;
 
 int fd_input, fd_output;
 
+/** Decompress only range of raw data */
+int range_enabled = 0;
+uint64_t range_offset = 0, range_size = UINT64_MAX;
+
 void help( char * name) {
 	printf( "Stream compressor/decompressor\n");
-	printf( "Usage: %s [-dxc] [infile] [outfile]\n", name);
+	printf( "Usage: %s [-dxcuiapg] [-b size] [-l bits] [-s streams] [-r offset[:size]] [infile] [outfile]\n", name);
 	printf( "-c -- compress\n");
 	printf( "-d|-x -- decompress\n");
+	printf( "-b -- size of block, %dK..%dM, K and M suffixes are allowed (default %dK),\n"
+			"      for decompression it is taken from stream if input is a file\n",
+			BLOCKSIZE_MIN / 1024, BLOCKSIZE_MAX / (1024*1024), BUFFERSIZE / 1024);
+	printf( "-l -- limit length of codes to 8..%d bits, 0 -- no limit (default %d)\n",
+			HENCODE_MAX_BITS, HBLOCK_MAX_CODELEN);
+	printf( "-s -- count of interleaved bit streams in block: 1 or %d (default %d)\n",
+			ZSTREAMS, ZSTREAMS);
+	printf( "-a -- split blocks adaptively where separate code tables give smaller output\n");
+	printf( "-p -- single pass: code every block with table built from the previous block\n");
+	printf( "-i -- write index of blocks for random access\n");
+	printf( "-r -- decompress only size bytes (all by default) starting from offset,\n"
+			"      input should be a file with index\n");
+	printf( "-u -- asynchronous I/O with io_uring, read()/write() are used if it is not available\n");
+	printf( "-g -- use portable kernels only, not ones for features of CPU\n");
 }
 
 /**
@@ -39,7 +64,8 @@ int parse_args( int argc, char **argv, mode_t *mode) {
 
 	// d -- decompress
 
-	char optstring[]="dxc";
+	char optstring[]="dxcuiapgb:l:s:r:";
+	char *end;
 
 	(* mode)=COMPRESSOR;
 	/* Default stdin/stdout */
@@ -55,12 +81,76 @@ int parse_args( int argc, char **argv, mode_t *mode) {
 			case 'd':
 				(* mode) = DECOMPRESSOR;
 				break;
+			case 'i':
+				hindex_enabled = 1;
+				break;
+			case 'a':
+				hsplit_enabled = 1;
+				break;
+			case 'p':
+				hchain_single_pass = 1;
+				break;
+			case 'r':
+				range_enabled = 1;
+				range_offset = strtoull( optarg, &end, 0);
+				if (*end == ':')
+					range_size = strtoull( end + 1, &end, 0);
+				if ((end == optarg) || (*end != '\0')) {
+					help( argv[0]);
+					exit(1);
+				}
+				break;
+			case 'u':
+				hio_uring = 1;
+				break;
+			case 'g':
+				hcpu_portable = 1;
+				break;
+			case 'b': {
+				unsigned long long size = strtoull( optarg, &end, 0);
+
+				if ((*end == 'K') || (*end == 'k')) {
+					size *= 1024;
+					end++;
+				} else if ((*end == 'M') || (*end == 'm')) {
+					size *= 1024*1024;
+					end++;
+				}
+				if ((end == optarg) || (*end != '\0') ||
+						(size < BLOCKSIZE_MIN) || (size > BLOCKSIZE_MAX)) {
+					help( argv[0]);
+					exit(1);
+				}
+				hblock_size = size;
+				break;
+			}
+			case 'l':
+				hblock_max_codelen = atoi( optarg);
+				if ((hblock_max_codelen != 0) &&
+						((hblock_max_codelen < 8) || (hblock_max_codelen > HENCODE_MAX_BITS))) {
+					help( argv[0]);
+					exit(1);
+				}
+				break;
+			case 's':
+				hblock_streams = atoi( optarg);
+				if ((hblock_streams != 1) && (hblock_streams != ZSTREAMS)) {
+					help( argv[0]);
+					exit(1);
+				}
+				break;
 			default:
 				help( argv[0]);
 				exit(1);
 		}
 	}
 
+	/* Range is taken from indexed stream, nothing to compress */
+	if (range_enabled && ((* mode) == COMPRESSOR)) {
+		fprintf( stderr, "Range (-r) could be used for decompression only\n");
+		exit(1);
+	}
+
 	/* Do not care about security here, huh */
 	/* Check if we have input filename */
 	if ( optind < argc ) {
@@ -82,7 +172,7 @@ int parse_args( int argc, char **argv, mode_t *mode) {
 	/* Check if we have output filename */
 	if ( optind < argc ) {
 
-		fd_output = open( argv[optind], O_CREAT|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+		fd_output = open( argv[optind], O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
 		if ( fd_output == -1 ) {
 			close( fd_input);
 			perror("Failed to create output file");
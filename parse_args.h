@@ -21,6 +21,10 @@ typedef enum appmode appmode_t;
 
 extern int fd_input, fd_output;
 
+/** Decompress only range of raw data */
+extern int range_enabled;
+extern uint64_t range_offset, range_size;
+
 /**
  * @brief Parse command line arguments
  *
@@ -89,7 +89,7 @@ hpb_t * streamreader ( int fd, uint8_t *buffer, size_t buffer_size) {
 		
 	/* Message parsed, hooray! */
 
-	DBGPRINT("Bits coded %d\n", msg->bits_len);
+	DBGPRINT("Bits coded %llu\n", (unsigned long long) msg->bits_len);
 
 
 	DBGPRINT("Successful read of message %d\n", msgcnt);